@@ -0,0 +1,22 @@
+#!/bin/bash
+# Builds the simulator and runs the headless benchmarks on a fixed seed.
+# Usage: ./bench.sh [BASELINE.json [TOLERANCE_PERCENT]]
+# Writes bench.json and microbench.json. Given a bench.json kept from an
+# earlier run, exits 1 if ticks_per_sec dropped by more than TOLERANCE_PERCENT
+# (default 10). Set THREADS to benchmark the parallel engine.
+set -e
+CC=${CC:-gcc}
+THREADS=${THREADS:-0}
+$CC -O2 -o bench.out main.c -lpthread
+./bench.out --bench --threads "$THREADS" > bench.json
+./bench.out --microbench > microbench.json
+cat bench.json
+if [ -n "$1" ]; then
+  OLD=$(grep -o '"ticks_per_sec": [0-9.]*' "$1" | cut -d ' ' -f 2)
+  NEW=$(grep -o '"ticks_per_sec": [0-9.]*' bench.json | cut -d ' ' -f 2)
+  TOLERANCE=${2:-10}
+  if awk -v old="$OLD" -v new="$NEW" -v t="$TOLERANCE" 'BEGIN { exit !(new < old * (1 - t / 100)) }'; then
+    echo "ticks_per_sec dropped from $OLD to $NEW"
+    exit 1
+  fi
+fi
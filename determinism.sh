@@ -0,0 +1,29 @@
+#!/bin/bash
+# Checks that a seed gives the same run whatever the thread count.
+# Usage: ./determinism.sh [TICKS [THREADS...]]
+# Runs the bench, which reproduces and mutates, for TICKS (default 2000)
+# with each thread count (default 0 1 2 4, 0 being the calling thread
+# alone) and exits 1 unless every run ends with the same state_hash.
+set -e
+CC=${CC:-gcc}
+TICKS=${1:-2000}
+shift || true
+THREADS=${*:-0 1 2 4}
+$CC -O2 -o bench.out main.c -lpthread
+hash() {
+  ./bench.out --bench --bench-ticks "$TICKS" --threads "$1" | grep -o '"state_hash": "[0-9a-f]*"' | cut -d '"' -f 4
+}
+FIRST=""
+for N in $THREADS; do
+  H=$(hash "$N")
+  echo "--threads $N: $H"
+  if [ -z "$H" ]; then
+    echo "--threads $N printed no state_hash"
+    exit 1
+  elif [ -z "$FIRST" ]; then
+    FIRST=$H
+  elif [ "$H" != "$FIRST" ]; then
+    echo "--threads $N differs from --threads ${THREADS%% *}"
+    exit 1
+  fi
+done
@@ -4,23 +4,170 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <termios.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <sys/ioctl.h>
 
-#define VM_SLOTS       1000
-#define NUM_LOE        1
-#define BOARD_WIDTH    10000
-#define BOARD_HEIGHT   10000
-#define NUM_REG        9
-#define MAX_ORGANISMS  50000
+#define INIT_ORGANISMS 1024
 #define MAX_LOOP_LEVEL 50
-#define SEARCH_DIST    25
 #define MAX_SIMUL_COLL 25
-#define ORG_TO_FOOD    4
-#define ORG_LIFESPAN   1000000
+#define SLAB_ORGANISMS 64
+#define STRIP_WIDTH    256
 #define ORG_REPRODUCE  300
-#define ORG_HUNGER     300
-#define ORG_FOOD       250
 
-//TODO: Add frameshift and bitwise mutations, organisms can have thread count mutated, etc.
+/*
+ * World and VM configuration. These used to be compile-time constants;
+ * they are now read from --config FILE or --name VALUE flags (see
+ * config_set) and checked by config_apply before anything is allocated.
+ */
+/* Kinds of mutation organism_lossy_copy applies, in the order their rates are drawn from */
+enum mutation {
+    MUTATION_DECREMENT, //subtract one from the byte
+    MUTATION_INCREMENT, //add one
+    MUTATION_NUDGE,     //add up to 24
+    MUTATION_RANDOM,    //replace with a random byte
+    MUTATION_BIT_FLIP,  //flip one bit
+    MUTATION_INSERT,    //insert a random byte, pushing the rest of the genome back one (the last byte falls off)
+    MUTATION_DELETE,    //delete the byte, pulling the rest forward one (a random byte fills the end)
+    MUTATION_DUPLICATE, //copy a block of up to MUTATION_BLOCK bytes from elsewhere in the genome over this spot
+    MUTATIONS
+};
+
+#define MUTATION_SCALE  (1 << 20) //mutation rates are per this many bytes copied
+#define MUTATION_BLOCK  16        //longest block MUTATION_DUPLICATE copies
+
+struct config {
+    int board_width;
+    int board_height;
+    int vm_slots;      //bytecodes per genome, at most 65535 (bracket table is 16 bit)
+    int num_loe;       //lines of execution per organism
+    int num_reg;       //registers per LOE, at most 10
+    int max_organisms;
+    int search_dist;   //how far the sensing opcodes and FIRE reach
+    int org_to_food;   //size divided by this is the food an eaten organism is worth
+    int org_lifespan;  //ticks before reproducing
+    int org_hunger;    //ticks per unit of food burned
+    int org_food;      //food an organism starts with
+    int quantum;       //instructions an LOE may run per tick, 1 for the classic one (see organism_loop_kernel)
+    int mutation_rates[MUTATIONS]; //by enum mutation, per MUTATION_SCALE bytes copied; together at most MUTATION_SCALE
+};
+
+#define DEATH_REASONS   8  //organism_delete reasons are 1-7
+
+/* Growable list of organisms */
+struct organism_list {
+    struct organism** items;
+    unsigned int num;
+    unsigned int cap;
+};
+
+/*
+ * Everything one simulated world owns. Worlds share nothing, so an
+ * ensemble (--ensemble) can run many of them at once, one per thread.
+ * Code reaches the world being stepped through the thread-local world
+ * pointer, which starts out at main_world on every thread.
+ */
+struct world {
+    struct config config;
+    unsigned long long seed;         //picks the board and every random stream
+    unsigned long long current_tick; //ticks run so far
+
+    /* Generation: densities are fractions of tiles, thresholds the hash values below which a tile is food, then obstacle */
+    double food_density;
+    double obstacle_density;
+    unsigned int food_threshold;
+    unsigned int obstacle_threshold;
+    unsigned long long generator_key; //seed premixed for tile_hash
+
+    /*
+     * Board blocks across and down. Directory rows are padded to a power
+     * of two (1 << env_directory_shift entries), so finding a block is a
+     * shift and an or for any board size.
+     */
+    unsigned int env_blocks_x;
+    unsigned int env_blocks_y;
+    unsigned int env_directory_shift;
+    unsigned int env_directory_size;
+    struct env_block** environment;     //contains environmental information, NULL until written
+    atomic_uint env_blocks_allocated;
+    struct organism*** occupant_blocks; //indexed like environment[]
+
+    /* Organism pool */
+    union organism_block* organism_free_list;
+    size_t organism_bytes;
+    unsigned char** organism_slabs; //every slab, so the world can be freed
+    unsigned int num_organism_slabs;
+    void (*organism_kernel)(struct organism* org); //picked by organism_kernel_select
+
+    /* Genome store, see struct genome_page */
+    unsigned int genome_num_pages;         //pages per genome
+    struct genome_page* genome_free_pages; //recycled pages, only touched while one thread steps the world
+    atomic_uint genome_pages;              //pages in use, shared ones counted once
+
+    /* Mutation: the rates summed, and mutation_survival[k] the chance of k bytes in a row copied without one (k up to vm_slots) */
+    unsigned int mutation_total;
+    double* mutation_survival;
+
+    unsigned long long instructions_executed; //VM instructions run, no-ops included
+    unsigned long long organism_births; //number of organisms ever created
+    unsigned long long organism_deaths; //number deleted, so births - deaths are alive
+    unsigned long long organism_deaths_by_reason[DEATH_REASONS];
+    int last_death_reason;
+
+    /* Organisms array, indexed by id and grown on demand up to config.max_organisms */
+    struct organism** organisms;
+    unsigned int* organism_generations; //generation of each slot in organisms[]
+    unsigned int organism_capacity;     //slots allocated in organisms[]
+    unsigned int organism_slots_used;   //slots ever handed out; slots past this have never been used
+    unsigned int* free_slots;           //stack of released slots, reused before fresh ones are handed out
+    unsigned int num_free_slots;
+
+    /*
+     * Every live organism, packed, in the order ticks sort them into
+     * strips. Births are appended and deaths swap-removed; both only
+     * happen between ticks, see the tick engine.
+     */
+    struct organism** active;
+    unsigned int num_active;
+    unsigned int active_capacity;
+
+    /* Strips of the board the tick engine steps, see strips_init */
+    int strip_width;
+    unsigned int num_strips;
+    struct tick_region* regions;
+    struct organism_list phases[2]; //organisms of even and odd strips, in active list order, when one thread steps them all
+};
+
+struct world main_world = {
+    .config = {
+        .board_width   = 10000,
+        .board_height  = 10000,
+        .vm_slots      = 1000,
+        .num_loe       = 1,
+        .num_reg       = 9,
+        .max_organisms = 16777216,
+        .search_dist   = 25,
+        .org_to_food   = 4,
+        .org_lifespan  = 1000000,
+        .org_hunger    = 300,
+        .org_food      = 250,
+        .quantum       = 1,
+        .mutation_rates = {1024, 1024, 1024, 2048} //the old per-byte 5 in 1024, no frameshifts, flips or duplications
+    },
+    .food_density     = 10.0 / 500,
+    .obstacle_density =  5.0 / 500
+};
+
+/* World the calling thread is stepping */
+__thread struct world* world = &main_world;
+
+//TODO: Organisms can have thread count mutated, etc.
 
 int PAUSE_FROM_STACKOVERFLOW()
 {
@@ -41,6 +188,327 @@ int PAUSE_FROM_STACKOVERFLOW()
 unsigned int columns;
 unsigned int rows;
 
+/*
+ * Trace logging. Events are fixed-size binary records pushed into a
+ * lock-free ring buffer and drained to a file by a background writer
+ * thread; run with --decode-trace to turn a trace file back into text.
+ * TRACE_LEVEL caps what gets compiled in (build with -DTRACE_LEVEL=0 to
+ * strip tracing entirely), --trace picks the level at runtime.
+ */
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL 3
+#endif
+#define TRACE_EVENTS       1 //births, deaths, reproduction
+#define TRACE_INSTRUCTIONS 2 //every bytecode instruction
+#define TRACE_DUMPS        3 //genome of every organism that is born or dies
+
+#define TRACE_RING_SIZE    65536 //records, must be a power of two
+#define TRACE_BATCH        1024  //records written per fwrite
+#define TRACE_MAGIC        0x54564543 //"CEVT"
+
+enum trace_event {
+    TRACE_INSTRUCTION, //arg = instruction, data = i_ptr, ptr
+    TRACE_BIRTH,       //data = parent id, x, y
+    TRACE_DEATH,       //arg = reason, data = food, ticks since birth, x, y
+    TRACE_REPRODUCE,   //data = food
+    TRACE_LOOP_LIMIT,  //too many nested loops
+    TRACE_GENOME       //arg = offset, data = 16 VM bytes
+};
+
+struct trace_record {
+    unsigned long long tick;
+    unsigned int organism;
+    unsigned short event;
+    unsigned short arg;
+    unsigned int data[4];
+};
+
+struct trace_cell {
+    atomic_size_t sequence;
+    struct trace_record record;
+};
+
+int trace_level = 0;
+struct trace_cell trace_ring[TRACE_RING_SIZE];
+atomic_size_t trace_enqueue_pos;
+size_t trace_dequeue_pos;
+atomic_int trace_stopping;
+FILE* trace_file = NULL;
+pthread_t trace_writer;
+
+/* Queues a record, waiting for the writer if the ring is full (multi-producer, single consumer) */
+void trace_push(const struct trace_record* record) {
+    size_t pos = atomic_load_explicit(&trace_enqueue_pos, memory_order_relaxed);
+    for(;;) {
+        struct trace_cell* cell = &trace_ring[pos & (TRACE_RING_SIZE-1)];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        if(sequence == pos) {
+            if(atomic_compare_exchange_weak_explicit(&trace_enqueue_pos, &pos, pos+1, memory_order_relaxed, memory_order_relaxed)) {
+                cell->record = *record;
+                atomic_store_explicit(&cell->sequence, pos+1, memory_order_release);
+                return;
+            }
+        } else if(sequence < pos) { //full, let the writer catch up
+            sched_yield();
+            pos = atomic_load_explicit(&trace_enqueue_pos, memory_order_relaxed);
+        } else {
+            pos = atomic_load_explicit(&trace_enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+void trace_emit(unsigned int organism, enum trace_event event, unsigned int arg, unsigned int d0, unsigned int d1, unsigned int d2, unsigned int d3) {
+    struct trace_record record;
+    record.tick = world->current_tick;
+    record.organism = organism;
+    record.event = event;
+    record.arg = arg;
+    record.data[0] = d0;
+    record.data[1] = d1;
+    record.data[2] = d2;
+    record.data[3] = d3;
+    trace_push(&record);
+}
+
+/* Emits a record if its level is both compiled in and enabled */
+#define TRACE(level, organism, event, arg, d0, d1, d2, d3) do { \
+        if(TRACE_LEVEL >= (level) && trace_level >= (level)) { \
+            trace_emit((organism), (event), (arg), (d0), (d1), (d2), (d3)); \
+        } \
+    } while(0)
+
+/*
+ * Metrics. Hot paths bump plain per-thread counters, and only while a
+ * sink is configured with --metrics. Every --metrics-every ticks the main
+ * thread folds them into a snapshot between ticks, when every worker is
+ * parked, and a background thread formats and writes it. Build with
+ * -DMETRICS=0 to compile the counters out entirely.
+ */
+#ifndef METRICS
+#define METRICS 1
+#endif
+#define METRICS_QUEUE   16 //snapshots waiting for the writer
+#define OPCODE_CLASSES  25
+
+struct metrics_counters {
+    unsigned long long opcodes[256];  //instructions executed, by byte
+    unsigned long long collisions[4]; //by environmental_tile collided with
+    struct metrics_counters* next;
+};
+
+int metrics_enabled = 0;
+__thread struct metrics_counters* metrics_local;
+struct metrics_counters* metrics_threads = NULL; //every thread's counters
+pthread_mutex_t metrics_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Gives the calling thread its counters. Every thread that steps organisms calls this first. */
+void metrics_attach() {
+    if(!METRICS || !metrics_enabled || metrics_local) {
+        return;
+    }
+    metrics_local = calloc(1, sizeof(struct metrics_counters));
+    pthread_mutex_lock(&metrics_threads_lock);
+    metrics_local->next = metrics_threads;
+    metrics_threads = metrics_local;
+    pthread_mutex_unlock(&metrics_threads_lock);
+}
+
+/* Bumps one of this thread's counters if metrics are on */
+#define METRIC_COUNT(counter) do { \
+        if(METRICS && metrics_enabled) { \
+            metrics_local->counter++; \
+        } \
+    } while(0)
+
+/* Writer thread: drains the ring to trace_file in batches until stopped and empty */
+void* trace_writer_main(void* unused) {
+    static struct trace_record batch[TRACE_BATCH];
+    for(;;) {
+        size_t count = 0;
+        while(count < TRACE_BATCH) {
+            struct trace_cell* cell = &trace_ring[trace_dequeue_pos & (TRACE_RING_SIZE-1)];
+            if(atomic_load_explicit(&cell->sequence, memory_order_acquire) != trace_dequeue_pos+1) {
+                break; //empty
+            }
+            batch[count++] = cell->record;
+            atomic_store_explicit(&cell->sequence, trace_dequeue_pos + TRACE_RING_SIZE, memory_order_release);
+            trace_dequeue_pos++;
+        }
+        if(count > 0) {
+            fwrite(batch, sizeof(struct trace_record), count, trace_file);
+        } else if(atomic_load(&trace_stopping)) {
+            break;
+        } else {
+            struct timespec nap = {0, 1000000};
+            nanosleep(&nap, NULL);
+        }
+    }
+    fflush(trace_file);
+    return NULL;
+}
+
+/* Opens the trace file and starts the writer. Returns 0 on failure. */
+int trace_start(const char* path, int level) {
+    trace_file = fopen(path, "wb");
+    if(!trace_file) {
+        perror(path);
+        return 0;
+    }
+    unsigned int header[3] = {TRACE_MAGIC, sizeof(struct trace_record), world->config.vm_slots}; //TRACE_GENOME records are cut to vm_slots
+    fwrite(header, sizeof(header), 1, trace_file);
+    size_t i;
+    for(i = 0; i < TRACE_RING_SIZE; i++) {
+        atomic_init(&trace_ring[i].sequence, i);
+    }
+    trace_level = level;
+    if(pthread_create(&trace_writer, NULL, trace_writer_main, NULL) != 0) {
+        fclose(trace_file);
+        trace_file = NULL;
+        trace_level = 0;
+        return 0;
+    }
+    return 1;
+}
+
+/* Flushes everything queued so far and stops the writer */
+void trace_stop() {
+    if(!trace_file) {
+        return;
+    }
+    trace_level = 0;
+    atomic_store(&trace_stopping, 1);
+    pthread_join(trace_writer, NULL);
+    fclose(trace_file);
+    trace_file = NULL;
+}
+
+/* Opcode class an instruction byte decodes to, 0 to OPCODE_CLASSES-1 */
+static inline unsigned int opcode_class(unsigned char instruction) {
+    if(instruction > 240) {
+        return OPCODE_CLASSES - 1;
+    }
+    return instruction == 0 ? 0 : (instruction-1) / 10;
+}
+
+/* Name of the opcode class an instruction byte decodes to */
+const char* opcode_name(unsigned char instruction) {
+    static const char* const names[] = {
+        "INC", "DEC", "*INC", "*DEC", "RIGHT", "LEFT", "FORWARD", "BACK",
+        "WHILE {", "}", "DETECT", "BIN DETECT", "*PTR -> REG", "REG -> *PTR",
+        "JMP", "GROW", "IF *PTR > 0, *PTR = 1", "DETECT OBSTACLE",
+        "vm[i_ptr] -> *ptr", "Rand -> *ptr", "ptr -> i_ptr", "Fire",
+        "DETECT FOOD", "Store location", "NOP"
+    };
+    return names[opcode_class(instruction)];
+}
+
+/* Prints a trace file as text. Returns a process exit code. */
+int trace_decode(const char* path) {
+    FILE* in = fopen(path, "rb");
+    if(!in) {
+        perror(path);
+        return 1;
+    }
+    unsigned int header[3];
+    if(fread(header, sizeof(header), 1, in) != 1 || header[0] != TRACE_MAGIC || header[1] != sizeof(struct trace_record)
+            || header[2] < 1 || header[2] > 65535) {
+        fprintf(stderr, "%s: not a trace file\n", path);
+        fclose(in);
+        return 1;
+    }
+    unsigned int vm_slots = header[2]; //of the run that wrote the trace, not ours
+    struct trace_record r;
+    while(fread(&r, sizeof(r), 1, in) == 1) {
+        printf("[%llu] Organism %u: ", r.tick, r.organism);
+        switch(r.event) {
+            case TRACE_INSTRUCTION:
+                printf("%s (ip %u, ptr %u)\n", opcode_name(r.arg), r.data[0], r.data[1]);
+                break;
+            case TRACE_BIRTH:
+                printf("born at %u,%u", r.data[1], r.data[2]);
+                if(r.data[0] != (unsigned int)-1) {
+                    printf(" from organism %u", r.data[0]);
+                }
+                printf("\n");
+                break;
+            case TRACE_DEATH:
+                printf("died for reason %u (food %d, age %u, at %u,%u)\n", r.arg, (int)r.data[0], r.data[1], r.data[2], r.data[3]);
+                break;
+            case TRACE_REPRODUCE:
+                printf("reproducing with food %d\n", (int)r.data[0]);
+                break;
+            case TRACE_LOOP_LIMIT:
+                printf("too many nested loops\n");
+                break;
+            case TRACE_GENOME: {
+                const unsigned char* bytes = (const unsigned char*)r.data;
+                unsigned int i;
+                printf("vm[%u..]:", r.arg);
+                for(i = 0; i < 16 && r.arg + i < vm_slots; i++) {
+                    printf(" %u", bytes[i]);
+                }
+                printf("\n");
+                break;
+            }
+            default:
+                printf("unknown event %u\n", r.event);
+                break;
+        }
+    }
+    fclose(in);
+    return 0;
+}
+
+/*
+ * Random numbers. Every organism draws from its own xoshiro256** stream,
+ * seeded from (world->seed, birth number) with splitmix64, and the board
+ * is a pure hash of (world->seed, x, y). Nothing is shared, so no locking
+ * is needed and a run only depends on --seed, not on the order organisms
+ * or threads are stepped in.
+ */
+
+struct rng {
+    unsigned long long s[4];
+};
+
+unsigned long long splitmix64(unsigned long long* x) {
+    unsigned long long z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Seeds an independent stream */
+void rng_seed(struct rng* r, unsigned long long seed, unsigned long long stream) {
+    unsigned long long x = seed ^ splitmix64(&stream);
+    int i;
+    for(i = 0; i < 4; i++) {
+        r->s[i] = splitmix64(&x);
+    }
+}
+
+static inline unsigned long long rng_rotl(unsigned long long x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline unsigned long long rng_next(struct rng* r) {
+    unsigned long long* s = r->s;
+    unsigned long long result = rng_rotl(s[1] * 5, 7) * 9;
+    unsigned long long t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rng_rotl(s[3], 45);
+    return result;
+}
+
+/* Uniform number in [0, n), using the high bits */
+static inline unsigned int rng_below(struct rng* r, unsigned int n) {
+    return (unsigned int)(((rng_next(r) >> 32) * n) >> 32);
+}
+
 /* What is contained in the environment */
 enum environmental_tile {
     ENVIRONMENT_EMPTY,
@@ -49,23 +517,223 @@ enum environmental_tile {
     ENVIRONMENT_FOOD
 };
 
-enum environmental_tile environment[BOARD_WIDTH][BOARD_HEIGHT]; //contains environmental information
+/*
+ * The board is stored one byte per tile in square blocks of
+ * ENV_BLOCK_SIZE x ENV_BLOCK_SIZE tiles (4 KB of tiles), row-major inside
+ * a block. Neighbours along either axis are then at most a block apart,
+ * so rays and row scans stay cache friendly in both directions.
+ * Always go through env_get/env_set rather than indexing directly.
+ */
+#define ENV_BLOCK_BITS 6
+#define ENV_BLOCK_SIZE (1 << ENV_BLOCK_BITS)
+#define ENV_BLOCK_MASK (ENV_BLOCK_SIZE - 1)
+
+/*
+ * Next to its tiles every block keeps one bit plane per non-empty tile
+ * type, stored twice: by row (bit x of rows[plane][y]) and by column
+ * (bit y of columns[plane][x]). A ray along either axis then reads one
+ * word per block it crosses and finds its first hit with a count of
+ * trailing or leading zeros instead of walking tile by tile.
+ * env_set keeps the planes in step with the tiles.
+ */
+#define ENV_PLANES 3
 
-void fill_environment() {
+#if ENV_BLOCK_SIZE != 64
+#error "bit planes assume 64 tiles per block row"
+#endif
+
+struct env_block {
+    unsigned char tiles[ENV_BLOCK_SIZE * ENV_BLOCK_SIZE];
+    unsigned long long rows[ENV_PLANES][ENV_BLOCK_SIZE];
+    unsigned long long columns[ENV_PLANES][ENV_BLOCK_SIZE];
+};
+
+/* Plane holding a tile type, -1 for ENVIRONMENT_EMPTY */
+static inline int env_plane(enum environmental_tile tile) {
+    return (int)tile - 1;
+}
+
+/*
+ * World generation. Each tile is a pure function of (world->seed, x, y),
+ * so blocks can be generated in any order, on any thread, or again later
+ * on their own. Densities are fractions of tiles, set by --food-density
+ * and --obstacle-density.
+ */
+
+void generator_init() {
+    double food = world->food_density * 4294967296.0;
+    double obstacle = (world->food_density + world->obstacle_density) * 4294967296.0;
+    world->food_threshold     = food     >= 4294967295.0 ? 4294967295u : (unsigned int)food;
+    world->obstacle_threshold = obstacle >= 4294967295.0 ? 4294967295u : (unsigned int)obstacle;
+    unsigned long long x = world->seed;
+    world->generator_key = splitmix64(&x);
+}
+
+/* 32 well-mixed bits for a tile (murmur3 finalizer) */
+static inline unsigned int tile_hash(unsigned int x, unsigned int y) {
+    unsigned long long h = world->generator_key ^ (((unsigned long long)y << 32) | x);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return (unsigned int)h;
+}
+
+/* Generated contents of a tile */
+static inline enum environmental_tile tile_generate(unsigned int x, unsigned int y) {
+    unsigned int h = tile_hash(x, y);
+    return h < world->food_threshold ? ENVIRONMENT_FOOD : h < world->obstacle_threshold ? ENVIRONMENT_OBSTACLE : ENVIRONMENT_EMPTY;
+}
+
+/* Writes the generated contents of one block, and its bit planes, into b */
+void generate_block(unsigned int block, struct env_block* b) {
+    unsigned int x0 = (block & ((1u << world->env_directory_shift) - 1)) << ENV_BLOCK_BITS;
+    unsigned int y0 = (block >> world->env_directory_shift) << ENV_BLOCK_BITS;
     unsigned int x;
     unsigned int y;
-    for(x = 0; x < BOARD_WIDTH; x++) {
-        for(y = 0; y < BOARD_HEIGHT; y++) {
-            int r = rand() % 500;
-            if(r < 10) {
-                environment[x][y] = ENVIRONMENT_FOOD;
-            } else if(r < 15) {
-                environment[x][y] = ENVIRONMENT_OBSTACLE;
+    memset(b->rows, 0, sizeof(b->rows));
+    memset(b->columns, 0, sizeof(b->columns));
+    for(y = 0; y < ENV_BLOCK_SIZE; y++) {
+        unsigned char* row = &b->tiles[y << ENV_BLOCK_BITS];
+        for(x = 0; x < ENV_BLOCK_SIZE; x++) {
+            enum environmental_tile tile = tile_generate(x0 + x, y0 + y);
+            int plane = env_plane(tile);
+            row[x] = (unsigned char)tile;
+            if(plane >= 0) {
+                b->rows[plane][y] |= 1ULL << x;
+                b->columns[plane][x] |= 1ULL << y;
             }
         }
     }
 }
 
+/*
+ * The board itself is sparse: a block is only allocated (and generated)
+ * the first time something is written to it. Until then reads are
+ * answered straight from tile_generate, so a run only pays memory for the
+ * neighbourhood its organisms actually change. The directory is a single
+ * array of pointers; its untouched pages are never committed either.
+ */
+
+/* Index of a block in environment[] */
+static inline unsigned int env_block_index(unsigned int x, unsigned int y) {
+    return ((y >> ENV_BLOCK_BITS) << world->env_directory_shift) | (x >> ENV_BLOCK_BITS);
+}
+
+/* Index of a tile inside its block */
+static inline unsigned int env_tile_index(unsigned int x, unsigned int y) {
+    return ((y & ENV_BLOCK_MASK) << ENV_BLOCK_BITS) | (x & ENV_BLOCK_MASK);
+}
+
+/* Returns a block, or NULL if it has never been written */
+static inline struct env_block* env_block(unsigned int block) {
+    return __atomic_load_n(&world->environment[block], __ATOMIC_ACQUIRE);
+}
+
+/* Allocates and generates a block. Two strips may race here in a parallel tick; the first one to publish wins. */
+struct env_block* env_materialize(unsigned int block) {
+    struct env_block* b = malloc(sizeof(struct env_block));
+    generate_block(block, b);
+    struct env_block* existing = NULL;
+    if(!__atomic_compare_exchange_n(&world->environment[block], &existing, b, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(b);
+        return existing;
+    }
+    atomic_fetch_add_explicit(&world->env_blocks_allocated, 1, memory_order_relaxed);
+    return b;
+}
+
+/* Returns the tile at (x, y). Everything off the board reads as an obstacle. */
+static inline enum environmental_tile env_get(unsigned int x, unsigned int y) {
+    if(x >= world->config.board_width || y >= world->config.board_height) {
+        return ENVIRONMENT_OBSTACLE;
+    }
+    struct env_block* b = env_block(env_block_index(x, y));
+    if(!b) {
+        return tile_generate(x, y);
+    }
+    return (enum environmental_tile)b->tiles[env_tile_index(x, y)];
+}
+
+/* Sets the tile at (x, y). Writes off the board are dropped. */
+static inline void env_set(unsigned int x, unsigned int y, enum environmental_tile tile) {
+    if(x >= world->config.board_width || y >= world->config.board_height) {
+        return;
+    }
+    unsigned int block = env_block_index(x, y);
+    struct env_block* b = env_block(block);
+    if(!b) {
+        b = env_materialize(block);
+    }
+    unsigned int index = env_tile_index(x, y);
+    int old_plane = env_plane((enum environmental_tile)b->tiles[index]);
+    int new_plane = env_plane(tile);
+    b->tiles[index] = (unsigned char)tile;
+    if(old_plane == new_plane) {
+        return;
+    }
+    /* Neighbouring strips can write other tiles of the same row word during a parallel tick */
+    unsigned int bx = x & ENV_BLOCK_MASK;
+    unsigned int by = y & ENV_BLOCK_MASK;
+    if(old_plane >= 0) {
+        __atomic_fetch_and(&b->rows[old_plane][by], ~(1ULL << bx), __ATOMIC_RELAXED);
+        __atomic_fetch_and(&b->columns[old_plane][bx], ~(1ULL << by), __ATOMIC_RELAXED);
+    }
+    if(new_plane >= 0) {
+        __atomic_fetch_or(&b->rows[new_plane][by], 1ULL << bx, __ATOMIC_RELAXED);
+        __atomic_fetch_or(&b->columns[new_plane][bx], 1ULL << by, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Word of a plane holding tile (x, y): the tile's block row if horizontal,
+ * else its block column. Rays only ever look a little way past an
+ * organism, so the blocks they cross are simply allocated here.
+ */
+static inline unsigned long long env_plane_word(int plane, int horizontal, unsigned int x, unsigned int y) {
+    unsigned int block = env_block_index(x, y);
+    struct env_block* b = env_block(block);
+    if(!b) {
+        b = env_materialize(block);
+    }
+    if(horizontal) {
+        return __atomic_load_n(&b->rows[plane][y & ENV_BLOCK_MASK], __ATOMIC_RELAXED);
+    }
+    return __atomic_load_n(&b->columns[plane][x & ENV_BLOCK_MASK], __ATOMIC_RELAXED);
+}
+
+atomic_uint next_generate_block;
+
+void* generate_worker(void* unused) {
+    unsigned int block;
+    while((block = atomic_fetch_add(&next_generate_block, 1)) < world->env_directory_size) {
+        if((block & ((1u << world->env_directory_shift) - 1)) < world->env_blocks_x && !env_block(block)) { //skip the padding
+            env_materialize(block);
+        }
+    }
+    return NULL;
+}
+
+/* Allocates and generates the whole board up front on every core (--prefill) */
+void fill_environment() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cores < 1) {
+        cores = 1;
+    }
+    pthread_t* workers = malloc(sizeof(pthread_t) * cores);
+    long started = 0;
+    atomic_store(&next_generate_block, 0);
+    while(started + 1 < cores && pthread_create(&workers[started], NULL, generate_worker, NULL) == 0) {
+        started++;
+    }
+    generate_worker(NULL);
+    long i;
+    for(i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+}
 struct location {
     unsigned int x;
     unsigned int y;
@@ -86,8 +754,12 @@ struct context_info {
     /* Main pointer */
     unsigned int ptr;
 
-    /* Registers */
-    unsigned char reg[NUM_REG];
+    /* Genome page i_ptr was last fetched from, so fetching skips the page table (see vm_fetch) */
+    unsigned int code_page; //UINT_MAX when nothing is cached
+    const unsigned char* code;
+
+    /* Registers, config.num_reg of them */
+    unsigned char* reg;
     
     /* Loop information */
     int loop_level; //depth of loop
@@ -97,8 +769,13 @@ struct context_info {
 struct organism {
     unsigned int id;
     
+    /* Position in world->active, and the strip it is stepped by this tick (see the tick engine) */
+    unsigned int active_index;
+    unsigned int strip;
+
     /* Used for managing death and causing hunger */
     unsigned int ticks_since_birth;
+    unsigned int ticks_until_hungry; //counts down from config.org_hunger, so hunger needs no division
 
     /* Current coordinate position */
     struct location pos;
@@ -110,22 +787,62 @@ struct organism {
     int food;
     enum direction dir;
 
-    /* Virtual machine bytecodes */
-    unsigned char vm[VM_SLOTS];
+    /*
+     * Virtual machine bytecodes, config.vm_slots of them, cut into pages
+     * that may be shared with relatives (see struct genome_page). Read
+     * them with vm_read and write them with vm_write.
+     */
+    struct genome_page** genome;
+
+    /*
+     * With --lineage, the genome as of its last archive record, holding
+     * references to those pages, and that genome's hash (see lineage_sync).
+     * NULL without --lineage.
+     */
+    struct genome_page** archived;
+    unsigned long long archived_hash;
 
-    struct context_info loe[NUM_LOE];
+    /* config.num_loe lines of execution */
+    struct context_info* loe;
 
     /* Shared register */
     unsigned char shared_reg;
+
+    /* Birth number, which also picks the organism's random stream */
+    unsigned long long serial;
+    struct rng rng;
+
+    /*
+     * Matching END for every WHILE in the genome, so a skipped loop is a
+     * single jump. Built on first use and rebuilt only after a write creates
+     * or destroys a bracket (brackets_dirty). Shared with relatives whose
+     * genomes differ from ours in no bracket.
+     */
+    struct bracket_table* brackets;
+    int brackets_dirty;
+
+    /* Death reason once killed during a tick; the deletion itself waits for the tick to end */
+    int dying;
 };
 
 //CHANGE LATER
-struct collision_information_bundle* organism_write_location(struct organism* o);
+struct collision_information_bundle;
+struct collision_information_bundle* organism_write_location(struct organism* o, struct collision_information_bundle* collisions);
+
+/*
+ * Generation-tagged reference to an organism slot. A slot's generation is
+ * bumped every time its organism dies, so a handle held across a death
+ * resolves to NULL instead of freed memory. Generation 0 is never valid.
+ */
+struct organism_handle {
+    unsigned int index;
+    unsigned int generation;
+};
 
 /* Holds collision data of organism */
 struct collision_information {
     enum environmental_tile collidedWith;
-    struct organism* org; //NULL unless collided with organism
+    struct organism_handle org; //null handle unless collided with organism
     struct location pos; //location of item that was collided with
 };
 
@@ -135,122 +852,643 @@ struct collision_information_bundle {
     struct collision_information collisions[MAX_SIMUL_COLL];
 };
 
-/* Randomizes virtual machine bytecodes using VM_SLOTS size. Used before reproduction. */
-void randomizeVM(unsigned char* toRead) {
+/* Lineage archive (--lineage), see lineage_start */
+int lineage_enabled = 0;
+void lineage_birth(struct organism* o, struct organism* parent);
+void lineage_death(struct organism* o, int reason);
+
+/*
+ * Organism pool. Organisms are carved out of slabs of SLAB_ORGANISMS and
+ * recycled through a free list, so births and deaths never reach malloc
+ * once the population has peaked. Slabs are only handed back by world_free.
+ * Each block is organism_bytes long: the organism, then its genome page
+ * table (two with --lineage), its LOEs and their registers, all sized by
+ * the configuration.
+ */
+union organism_block {
+    union organism_block* next; //valid while the block is on the free list
+    struct organism org;
+};
+
+/* Takes an organism from the pool, adding a slab if it is empty. NULL if out of memory. */
+struct organism* organism_alloc() {
+    if(!world->organism_free_list) {
+        unsigned char* slab = malloc(world->organism_bytes * SLAB_ORGANISMS);
+        unsigned char** slabs = realloc(world->organism_slabs, sizeof(unsigned char*) * (world->num_organism_slabs + 1));
+        if(!slab || !slabs) {
+            free(slab);
+            return NULL;
+        }
+        world->organism_slabs = slabs;
+        world->organism_slabs[world->num_organism_slabs++] = slab;
+        int i;
+        for(i = 0; i < SLAB_ORGANISMS; i++) {
+            union organism_block* block = (union organism_block*)(slab + i * world->organism_bytes);
+            block->next = i+1 < SLAB_ORGANISMS ? (union organism_block*)(slab + (i+1) * world->organism_bytes) : NULL;
+        }
+        world->organism_free_list = (union organism_block*)slab;
+    }
+    union organism_block* block = world->organism_free_list;
+    world->organism_free_list = block->next;
+    struct organism* o = &block->org;
+    unsigned char* storage = (unsigned char*)(block + 1);
+    o->genome = (struct genome_page**)storage;
+    memset(o->genome, 0, sizeof(struct genome_page*) * world->genome_num_pages);
+    storage += sizeof(struct genome_page*) * world->genome_num_pages;
+    o->archived = NULL;
+    if(lineage_enabled) {
+        o->archived = (struct genome_page**)storage;
+        memset(o->archived, 0, sizeof(struct genome_page*) * world->genome_num_pages);
+        storage += sizeof(struct genome_page*) * world->genome_num_pages;
+    }
+    o->loe = (struct context_info*)storage;
+    storage += world->config.num_loe * sizeof(struct context_info);
     int i;
-    for(i = 0; i < VM_SLOTS; i++) {
-        toRead[i] = (unsigned char)rand();
+    for(i = 0; i < world->config.num_loe; i++) {
+        o->loe[i].reg = storage;
+        storage += world->config.num_reg;
     }
+    return o;
 }
 
-/* Current organism max id */
-unsigned int max_organism_id = 0;
+/* Returns an organism to the pool */
+void organism_release(struct organism* o) {
+    union organism_block* block = (union organism_block*)o;
+    block->next = world->organism_free_list;
+    world->organism_free_list = block;
+}
 
-/* Organisms array */
-struct organism* organisms[MAX_ORGANISMS];
+void organism_list_push(struct organism_list* list, struct organism* o) {
+    if(list->num == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 64;
+        list->items = realloc(list->items, sizeof(struct organism*) * list->cap);
+    }
+    list->items[list->num++] = o;
+}
 
-void organism_print(struct organism* o) {
-    printf("Organism %u:\n", o->id);
-    printf("x: %u, y: %u\n", o->pos.x, o->pos.y);
-    printf("width: %u, height: %u\n", o->width, o->height);
-    printf("food: %u, direction: %u\n", o->food, o->dir);
-    printf("Printing 50 VM bytecodes:\n");
+/*
+ * A vertical strip of the board, world->strip_width tiles wide, as seen
+ * by the tick engine. Deaths and reproduction are global side effects, so
+ * while strips are being stepped they are queued on the strip that caused
+ * them and carried out in strip order once every strip has run.
+ */
+struct tick_region {
+    struct organism_list members;     //organisms stepped by this strip, in active list order
+    struct organism_list deaths;      //killed this tick, reason in ->dying
+    struct organism_list reproducing; //reached config.org_lifespan this tick
+    unsigned long cost;               //estimated work, used to hand out big strips first
+    unsigned long long instructions;  //executed this tick, added to world->instructions_executed once it ends
+};
+
+/* Strip the current thread is stepping, or NULL between ticks */
+__thread struct tick_region* current_region = NULL;
+
+/* Number of threads stepping strips, 0 when the calling thread steps them all (see the tick engine) */
+unsigned int tick_threads = 0;
+
+/*
+ * Genome store. Genomes are cut into pages of GENOME_PAGE_SIZE bytecodes
+ * and each organism only holds a table of page pointers. Pages are
+ * reference counted: a child shares its parent's pages and copies only
+ * the ones its mutations land on, and a shared page is copied again only
+ * when an organism writes to it through *ptr. Copies can happen while
+ * several threads step strips, so the counts are atomic, and pages taken
+ * or dropped then go straight to malloc rather than the world's free list.
+ */
+#define GENOME_PAGE_BITS 6
+#define GENOME_PAGE_SIZE (1 << GENOME_PAGE_BITS) //a cache line
+#define GENOME_PAGE_MASK (GENOME_PAGE_SIZE - 1)
+
+struct genome_page {
+    union {
+        atomic_uint refs;         //genomes holding the page
+        struct genome_page* next; //valid while the page is on the free list
+    };
+    unsigned char bytes[GENOME_PAGE_SIZE];
+};
+
+/* Takes a page holding one reference */
+struct genome_page* genome_page_alloc() {
+    struct genome_page* page;
+    if((!current_region || !tick_threads) && world->genome_free_pages) {
+        page = world->genome_free_pages;
+        world->genome_free_pages = page->next;
+    } else {
+        page = malloc(sizeof(struct genome_page));
+    }
+    atomic_init(&page->refs, 1);
+    atomic_fetch_add_explicit(&world->genome_pages, 1, memory_order_relaxed);
+    return page;
+}
+
+/* Drops a reference to a page, recycling the page with the last one */
+void genome_page_release(struct genome_page* page) {
+    /* acq_rel, so whoever drops the last reference has seen every other holder finish copying */
+    if(atomic_fetch_sub_explicit(&page->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    atomic_fetch_sub_explicit(&world->genome_pages, 1, memory_order_relaxed);
+    if(current_region && tick_threads) {
+        free(page);
+        return;
+    }
+    page->next = world->genome_free_pages;
+    world->genome_free_pages = page;
+}
+
+/* Forgets the pages cached for fetching, whenever the page table changes */
+static inline void genome_forget_code(struct organism* o) {
     int i;
-    for(i = 0; i < 50; i++) {
-        printf("%u ", (o->vm)[i]);
+    for(i = 0; i < world->config.num_loe; i++) {
+        o->loe[i].code_page = UINT_MAX;
     }
-    printf("\n");
-    for(i = 0; i < NUM_LOE; i++) {
-        printf("LOE #%d:\n", i);
-        printf("  IP: %u\n", o->loe[i].i_ptr);
-        printf("  *IP: %u\n", o->vm[o->loe[i].i_ptr]);
-        printf("  P: %u\n", o->loe[i].ptr);
-        printf("  *P: %u\n", o->vm[o->loe[i].ptr]);
-        int p;
-        for(p = 0; p < NUM_REG; p++) {
-            printf("  Register %d: %u\n", p, o->loe[i].reg[p]);
+}
+
+/* Drops every page of a page table */
+void genome_table_release(struct genome_page** table) {
+    unsigned int p;
+    for(p = 0; p < world->genome_num_pages; p++) {
+        if(table[p]) {
+            genome_page_release(table[p]);
+            table[p] = NULL;
         }
     }
 }
 
-/* Performs linear search of the array to find an empty slot */
-unsigned int next_organism_id() {
-    int i;
-    for(i = 0; i < MAX_ORGANISMS; i++) {
-        if(organisms[i] == NULL) {
-            return i;
+/* Points a page table at every page of another */
+void genome_table_share(struct genome_page** table, struct genome_page** from) {
+    unsigned int p;
+    for(p = 0; p < world->genome_num_pages; p++) {
+        if(table[p] == from[p]) {
+            continue;
         }
+        atomic_fetch_add_explicit(&from[p]->refs, 1, memory_order_relaxed);
+        if(table[p]) {
+            genome_page_release(table[p]);
+        }
+        table[p] = from[p];
     }
-    return MAX_ORGANISMS+1;
 }
 
-/* Deletes an organism */
-void organism_delete(struct organism* org, int reason) {
-    organisms[org->id] = NULL;
-    printf("Organism %d died for reason %d\n", org->id, reason);
-    printf("---------DUMPING DELETE DATA-----------\n");
-    organism_print(org);
-    printf("---------DUMPING VM--------------------\n");
+/* Drops every page of an organism's genome */
+void genome_release(struct organism* o) {
+    genome_forget_code(o);
+    genome_table_release(o->genome);
+}
+
+/* Makes o's genome share every page of from's */
+void genome_share(struct organism* o, struct organism* from) {
+    genome_forget_code(o);
+    genome_table_share(o->genome, from->genome);
+}
+
+/* Gives an organism a genome of its own, drawn from its random stream */
+void genome_randomize(struct organism* o) {
+    genome_release(o);
     unsigned int i;
-    for(i = 0; i < VM_SLOTS; i++) {
-        printf("%d ", org->vm[i]);
+    for(i = 0; i < world->genome_num_pages << GENOME_PAGE_BITS; i++) {
+        if(!(i & GENOME_PAGE_MASK)) {
+            o->genome[i >> GENOME_PAGE_BITS] = genome_page_alloc();
+        }
+        o->genome[i >> GENOME_PAGE_BITS]->bytes[i & GENOME_PAGE_MASK] = i < world->config.vm_slots ? (unsigned char)rng_next(&o->rng) : 0;
     }
-    printf("\n---------END DUMPING VM----------------\n");
-    printf("---------END DUMPING DELETE DATA-------\n");
-    free(org);
 }
 
-struct organism* organism_factory() {
-    unsigned int new_id = next_organism_id();
-    if(new_id > max_organism_id) {
-        max_organism_id = new_id;
+/* Replaces a shared page of an organism's genome with a copy of its own, and returns the copy */
+__attribute__((noinline, cold)) struct genome_page* genome_privatize(struct organism* o, unsigned int p) {
+    struct genome_page* shared = o->genome[p];
+    struct genome_page* page = genome_page_alloc();
+    memcpy(page->bytes, shared->bytes, GENOME_PAGE_SIZE);
+    genome_page_release(shared);
+    o->genome[p] = page;
+    genome_forget_code(o);
+    return page;
+}
+
+/* Reads one bytecode of an organism's genome */
+static inline unsigned char vm_read(const struct organism* o, unsigned int index) {
+    return o->genome[index >> GENOME_PAGE_BITS]->bytes[index & GENOME_PAGE_MASK];
+}
+
+/* Reads the instruction under an LOE's i_ptr, which must be inside the genome */
+static inline unsigned char vm_fetch(const struct organism* o, struct context_info* execution_context) {
+    unsigned int page = execution_context->i_ptr >> GENOME_PAGE_BITS;
+    if(page != execution_context->code_page) {
+        execution_context->code_page = page;
+        execution_context->code = o->genome[page]->bytes;
     }
-    if(new_id > MAX_ORGANISMS) {
-        /* No available slots */
+    return execution_context->code[execution_context->i_ptr & GENOME_PAGE_MASK];
+}
+
+/* Copies an organism's whole genome out, config.vm_slots bytes */
+void genome_copy_out(const struct organism* o, unsigned char* bytes) {
+    unsigned int i;
+    for(i = 0; i < world->config.vm_slots; i += GENOME_PAGE_SIZE) {
+        unsigned int n = world->config.vm_slots - i < GENOME_PAGE_SIZE ? world->config.vm_slots - i : GENOME_PAGE_SIZE;
+        memcpy(bytes + i, o->genome[i >> GENOME_PAGE_BITS]->bytes, n);
+    }
+}
+
+/*
+ * Occupant index: the owner of every organism tile, kept next to
+ * environment[] so point lookups don't have to scan organisms[].
+ * It uses the same blocks as environment[], but a block is only
+ * allocated once an organism is written into it.
+ */
+
+/* Returns the owner slot of a tile, allocating its block if create is set. NULL if off the board. */
+struct organism** occupant_slot(unsigned int x, unsigned int y, int create) {
+    if(x >= world->config.board_width || y >= world->config.board_height) {
+        return NULL;
+    }
+    struct organism*** block = &world->occupant_blocks[env_block_index(x, y)];
+    struct organism** tiles = __atomic_load_n(block, __ATOMIC_ACQUIRE);
+    if(!tiles) {
+        if(!create) {
+            return NULL;
+        }
+        /* Two strips may reach the same block in a parallel tick; the first one to publish wins */
+        struct organism** fresh = calloc(ENV_BLOCK_SIZE * ENV_BLOCK_SIZE, sizeof(struct organism*));
+        if(__atomic_compare_exchange_n(block, &tiles, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            tiles = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+    return &tiles[env_tile_index(x, y)];
+}
+
+/* Returns the organism occupying a tile, or NULL */
+struct organism* occupant_get(unsigned int x, unsigned int y) {
+    struct organism** slot = occupant_slot(x, y, 0);
+    return slot ? *slot : NULL;
+}
+
+/* Writes a tile to the environment and keeps the occupant index in sync */
+void environment_write(unsigned int x, unsigned int y, enum environmental_tile tile, struct organism* owner) {
+    env_set(x, y, tile);
+    struct organism** slot = occupant_slot(x, y, tile == ENVIRONMENT_ORGANISM);
+    if(slot) {
+        *slot = tile == ENVIRONMENT_ORGANISM ? owner : NULL;
+    }
+}
+
+void organism_print(struct organism* o) {
+    printf("Organism %u:\n", o->id);
+    printf("x: %u, y: %u\n", o->pos.x, o->pos.y);
+    printf("width: %u, height: %u\n", o->width, o->height);
+    printf("food: %u, direction: %u\n", o->food, o->dir);
+    printf("Printing 50 VM bytecodes:\n");
+    int i;
+    for(i = 0; i < 50; i++) {
+        printf("%u ", vm_read(o, i));
+    }
+    printf("\n");
+    for(i = 0; i < world->config.num_loe; i++) {
+        printf("LOE #%d:\n", i);
+        printf("  IP: %u\n", o->loe[i].i_ptr);
+        printf("  *IP: %u\n", vm_read(o, o->loe[i].i_ptr));
+        printf("  P: %u\n", o->loe[i].ptr);
+        printf("  *P: %u\n", vm_read(o, o->loe[i].ptr));
+        int p;
+        for(p = 0; p < world->config.num_reg; p++) {
+            printf("  Register %d: %u\n", p, o->loe[i].reg[p]);
+        }
+    }
+}
+
+/* Doubles the organism slot arrays. Returns 0 if config.max_organisms is reached or memory runs out. */
+int organism_slots_grow() {
+    unsigned int new_capacity = world->organism_capacity ? world->organism_capacity * 2 : INIT_ORGANISMS;
+    if(new_capacity > world->config.max_organisms) {
+        new_capacity = world->config.max_organisms;
+    }
+    if(new_capacity <= world->organism_capacity) {
+        return 0;
+    }
+    struct organism** new_organisms = realloc(world->organisms, sizeof(struct organism*) * new_capacity);
+    if(!new_organisms) return 0;
+    world->organisms = new_organisms;
+    unsigned int* new_generations = realloc(world->organism_generations, sizeof(unsigned int) * new_capacity);
+    if(!new_generations) return 0;
+    world->organism_generations = new_generations;
+    unsigned int* new_free_slots = realloc(world->free_slots, sizeof(unsigned int) * new_capacity);
+    if(!new_free_slots) return 0;
+    world->free_slots = new_free_slots;
+
+    unsigned int i;
+    for(i = world->organism_capacity; i < new_capacity; i++) {
+        world->organisms[i] = NULL;
+        world->organism_generations[i] = 1;
+    }
+    world->organism_capacity = new_capacity;
+    return 1;
+}
+
+/* Pops a free slot, or hands out a fresh one. Returns config.max_organisms+1 if there is no room. */
+unsigned int next_organism_id() {
+    if(world->num_free_slots > 0) {
+        return world->free_slots[--world->num_free_slots];
+    }
+    if(world->organism_slots_used == world->organism_capacity && !organism_slots_grow()) {
+        return world->config.max_organisms+1;
+    }
+    return world->organism_slots_used++;
+}
+
+/* Appends a newborn to the active list. Returns 0 if out of memory. */
+int active_push(struct organism* o) {
+    if(world->num_active == world->active_capacity) { //gaps left while stepping can outnumber free slots, so this grows on its own
+        unsigned int new_capacity = world->active_capacity ? world->active_capacity * 2 : INIT_ORGANISMS;
+        struct organism** new_active = realloc(world->active, sizeof(struct organism*) * new_capacity);
+        if(!new_active) return 0;
+        world->active = new_active;
+        world->active_capacity = new_capacity;
+    }
+    o->active_index = world->num_active;
+    world->active[world->num_active++] = o;
+    return 1;
+}
+
+/* Takes a dead organism off the active list, see struct world */
+void active_remove(struct organism* o) {
+    struct organism* last = world->active[--world->num_active];
+    world->active[o->active_index] = last;
+    last->active_index = o->active_index;
+}
+
+/* Returns a handle to an organism */
+struct organism_handle organism_handle_of(struct organism* o) {
+    struct organism_handle h;
+    h.index = o->id;
+    h.generation = world->organism_generations[o->id];
+    return h;
+}
+
+/* Returns the organism a handle refers to, or NULL if it is null or has died since */
+struct organism* organism_from_handle(struct organism_handle h) {
+    if(h.generation == 0 || h.index >= world->organism_capacity || world->organism_generations[h.index] != h.generation) {
+        return NULL;
+    }
+    return world->organisms[h.index];
+}
+
+void organism_clear_location(struct organism* o);
+
+/* Emits an organism's whole genome as TRACE_GENOME records */
+void trace_genome(struct organism* o) {
+    unsigned int offset;
+    for(offset = 0; offset < world->config.vm_slots; offset += 16) {
+        unsigned int data[4] = {0, 0, 0, 0};
+        unsigned char* bytes = (unsigned char*)data;
+        unsigned int i;
+        for(i = 0; i < 16 && offset + i < world->config.vm_slots; i++) {
+            bytes[i] = vm_read(o, offset + i);
+        }
+        trace_emit(o->id, TRACE_GENOME, offset, data[0], data[1], data[2], data[3]);
+    }
+}
+
+/* Returns whether an instruction is a loop bracket */
+static inline int is_while(unsigned char instruction) {
+    return instruction >= 81 && instruction <= 90;
+}
+static inline int is_end(unsigned char instruction) {
+    return instruction >= 91 && instruction <= 100;
+}
+
+/* Returns whether an instruction does nothing but step the LOE */
+static inline int is_nop(unsigned char instruction) {
+    return instruction >= 241;
+}
+
+/* Returns whether an instruction reads or changes the board (moving, sensing, growing, firing) rather than only its organism */
+static inline int touches_world(unsigned char instruction) {
+    return (instruction >= 61 && instruction <= 80)    //FORWARD, BACK
+        || (instruction >= 101 && instruction <= 120)  //DETECT, BIN DETECT
+        || (instruction >= 151 && instruction <= 160)  //GROW
+        || (instruction >= 171 && instruction <= 180)  //DETECT OBSTACLE
+        || (instruction >= 211 && instruction <= 230); //FIRE, DETECT FOOD
+}
+
+/*
+ * Write through a VM pointer. Writes past the genome (vm_slots long) are
+ * dropped, and a page still shared with another genome is copied first.
+ * Writing the value already there changes nothing, so it copies nothing.
+ */
+static inline void vm_write(struct organism* org, unsigned int index, unsigned char value, unsigned int vm_slots) {
+    if(index >= vm_slots) {
+        return;
+    }
+    struct genome_page* page = org->genome[index >> GENOME_PAGE_BITS];
+    unsigned char old = page->bytes[index & GENOME_PAGE_MASK];
+    if(old == value) {
+        return;
+    }
+    if(is_while(old) || is_end(old) || is_while(value) || is_end(value)) {
+        org->brackets_dirty = 1;
+    }
+    if(__builtin_expect(atomic_load_explicit(&page->refs, memory_order_acquire) > 1, 0)) {
+        page = genome_privatize(org, index >> GENOME_PAGE_BITS);
+    }
+    page->bytes[index & GENOME_PAGE_MASK] = value;
+}
+
+/* Overwrites an organism's whole genome with config.vm_slots bytes */
+void genome_load(struct organism* o, const unsigned char* bytes) {
+    unsigned int i;
+    for(i = 0; i < world->config.vm_slots; i++) {
+        vm_write(o, i, bytes[i], world->config.vm_slots);
+    }
+}
+
+/* Returns page p of an organism's genome ready to be rewritten whole, copying it first if it is shared */
+static inline struct genome_page* genome_page_own(struct organism* o, unsigned int p) {
+    struct genome_page* page = o->genome[p];
+    if(atomic_load_explicit(&page->refs, memory_order_acquire) > 1) {
+        page = genome_privatize(o, p);
+    }
+    return page;
+}
+
+/*
+ * Inserts a byte at index, pushing the rest of the genome back one so the
+ * last byte falls off. Each page is shifted with one memmove, the byte
+ * pushed off a page's end becoming the next page's first, so an indel
+ * costs a copy per page rather than a vm_write per byte.
+ */
+void genome_insert(struct organism* o, unsigned int index, unsigned char value) {
+    unsigned int vm_slots = world->config.vm_slots;
+    unsigned int first = index >> GENOME_PAGE_BITS;
+    unsigned int p = (vm_slots - 1) >> GENOME_PAGE_BITS;
+    for(;; p--) { //back to front, so each page still holds the byte the next one takes
+        struct genome_page* page = genome_page_own(o, p);
+        unsigned int start = p == first ? index & GENOME_PAGE_MASK : 0;
+        unsigned int end = vm_slots - (p << GENOME_PAGE_BITS) < GENOME_PAGE_SIZE ? vm_slots - (p << GENOME_PAGE_BITS) : GENOME_PAGE_SIZE;
+        memmove(page->bytes + start + 1, page->bytes + start, end - start - 1);
+        if(p == first) {
+            page->bytes[start] = value;
+            break;
+        }
+        page->bytes[0] = o->genome[p - 1]->bytes[GENOME_PAGE_MASK];
+    }
+    o->brackets_dirty = 1;
+}
+
+/* Deletes the byte at index, pulling the rest of the genome forward one and putting value last */
+void genome_delete(struct organism* o, unsigned int index, unsigned char value) {
+    unsigned int vm_slots = world->config.vm_slots;
+    unsigned int last = (vm_slots - 1) >> GENOME_PAGE_BITS;
+    unsigned int p;
+    for(p = index >> GENOME_PAGE_BITS; p <= last; p++) { //front to back, so each page takes the next one's first byte before it moves
+        struct genome_page* page = genome_page_own(o, p);
+        unsigned int start = p == index >> GENOME_PAGE_BITS ? index & GENOME_PAGE_MASK : 0;
+        unsigned int end = vm_slots - (p << GENOME_PAGE_BITS) < GENOME_PAGE_SIZE ? vm_slots - (p << GENOME_PAGE_BITS) : GENOME_PAGE_SIZE;
+        memmove(page->bytes + start, page->bytes + start + 1, end - start - 1);
+        page->bytes[end - 1] = p == last ? value : o->genome[p + 1]->bytes[0];
+    }
+    o->brackets_dirty = 1;
+}
+
+/* Bracket table, shared between genomes like their pages */
+struct bracket_table {
+    atomic_uint refs;
+    unsigned short match[]; //config.vm_slots of them
+};
+
+/* Drops a reference to a bracket table, freeing it with the last one */
+void bracket_table_release(struct bracket_table* table) {
+    if(table && atomic_fetch_sub_explicit(&table->refs, 1, memory_order_acq_rel) == 1) {
+        free(table);
+    }
+}
+
+/* Rebuilds the bracket table with a stack so nested loops pair up. Unmatched WHILEs map to config.vm_slots. */
+void organism_match_brackets(struct organism* org) {
+    if(!org->brackets || atomic_load_explicit(&org->brackets->refs, memory_order_acquire) > 1) { //relatives may still use a shared one
+        struct bracket_table* table = malloc(sizeof(struct bracket_table) + sizeof(unsigned short) * world->config.vm_slots);
+        atomic_init(&table->refs, 1);
+        bracket_table_release(org->brackets);
+        org->brackets = table;
+    }
+    unsigned short open[world->config.vm_slots]; //at most 128 KB
+    unsigned int depth = 0;
+    unsigned int i;
+    for(i = 0; i < world->config.vm_slots; i++) {
+        unsigned char instruction = vm_read(org, i);
+        if(is_while(instruction)) {
+            org->brackets->match[i] = world->config.vm_slots;
+            open[depth++] = i;
+        } else if(is_end(instruction) && depth > 0) {
+            org->brackets->match[open[--depth]] = i;
+        }
+    }
+    org->brackets_dirty = 0;
+}
+
+/* Deletes an organism. While strips are being stepped it is only marked, see struct tick_region. */
+void organism_delete(struct organism* org, int reason) {
+    if(current_region) {
+        if(!org->dying) {
+            org->dying = reason;
+            organism_list_push(&current_region->deaths, org);
+        }
+        return;
+    }
+    world->organisms[org->id] = NULL;
+    active_remove(org);
+    world->organism_deaths++;
+    world->organism_deaths_by_reason[reason < DEATH_REASONS ? reason : 0]++;
+    world->last_death_reason = reason;
+    world->organism_generations[org->id]++;
+    world->free_slots[world->num_free_slots++] = org->id;
+    /* Take the body off the board so the occupant index never points at freed memory */
+    organism_clear_location(org);
+    TRACE(TRACE_EVENTS, org->id, TRACE_DEATH, reason, org->food, org->ticks_since_birth, org->pos.x, org->pos.y);
+    if(TRACE_LEVEL >= TRACE_DUMPS && trace_level >= TRACE_DUMPS) {
+        trace_genome(org);
+    }
+    if(lineage_enabled) {
+        lineage_death(org, reason);
+    }
+    bracket_table_release(org->brackets);
+    genome_release(org);
+    organism_release(org);
+}
+
+void organism_lossy_copy(struct organism* first, struct organism* second);
+
+/* Creates an organism at the center of the board, with a random genome or a mutated copy of parent's */
+struct organism* organism_spawn(struct organism* parent) {
+    unsigned int new_id = next_organism_id();
+    if(new_id > world->config.max_organisms) {
+        /* No available slots */
         printf("No organism slots available!\n");
         return NULL;
     }
-    
     /* Create and initialize ID */
-    struct organism* new_org = malloc(sizeof(struct organism));
+    struct organism* new_org = organism_alloc();
+    if(!new_org || !active_push(new_org)) {
+        printf("Out of memory for organisms!\n");
+        if(new_org) {
+            organism_release(new_org);
+        }
+        world->free_slots[world->num_free_slots++] = new_id;
+        return NULL;
+    }
     new_org->id = new_id;
-    organisms[new_id] = new_org;
+    world->organisms[new_id] = new_org;
 
     /* Move organism to center */
-    new_org->pos.x = BOARD_WIDTH/2;
-    new_org->pos.y = BOARD_HEIGHT/2;
+    new_org->pos.x = world->config.board_width/2;
+    new_org->pos.y = world->config.board_height/2;
 
     /* Initialize width, height, food, and direction */
     new_org->width  = 1;
     new_org->height = 1;
-    new_org->food   = ORG_FOOD;
+    new_org->food   = world->config.org_food;
     new_org->dir    = DIRECTION_UP;
     
     /* Set registers and instruction pointer to 0 on all LOE */
     int i;
-    for(i = 0; i < NUM_LOE; i++) {
+    for(i = 0; i < world->config.num_loe; i++) {
         new_org->loe[i].i_ptr = 0;
         new_org->loe[i].ptr = 0;
+        new_org->loe[i].loop_level = 0;
         int o;
-        for(o = 0; o < NUM_REG; o++) {
+        for(o = 0; o < world->config.num_reg; o++) {
             new_org->loe[i].reg[o] = 0;
         }
     }
     
     /* If running with more than two threads, set to special indices */
-    if(NUM_LOE > 2) {
-        new_org->loe[1].i_ptr = 500;
-        new_org->loe[2].i_ptr = 750;
+    if(world->config.num_loe > 2) {
+        new_org->loe[1].i_ptr = world->config.vm_slots / 2;
+        new_org->loe[2].i_ptr = world->config.vm_slots * 3 / 4;
     }
     
     /* Set ticks */
     new_org->ticks_since_birth = 0;
+    new_org->ticks_until_hungry = world->config.org_hunger;
 
-    /* Randomize VM bits */
-    randomizeVM(new_org->vm);
+    /* Give it a random stream of its own, then a genome */
+    new_org->serial = world->organism_births++;
+    rng_seed(&new_org->rng, world->seed, new_org->serial);
+    new_org->brackets = NULL;
+    new_org->brackets_dirty = 1;
+    if(parent) {
+        organism_lossy_copy(parent, new_org);
+    } else {
+        genome_randomize(new_org);
+    }
+    if(lineage_enabled) {
+        lineage_birth(new_org, parent);
+    }
+    new_org->dying = 0;
     
-    /* Draw organism on environment */
-    organism_write_location(new_org);
+    /* Draw organism on environment; nothing has happened to it yet, so collisions are dropped */
+    struct collision_information_bundle ignored;
+    organism_write_location(new_org, &ignored);
 
     /* One last bit of housekeeping... */
     new_org->shared_reg = 0;
@@ -258,9 +1496,15 @@ struct organism* organism_factory() {
     return new_org;
 }
 
+/* Creates an organism at the center of the board with a random genome */
+struct organism* organism_factory() {
+    return organism_spawn(NULL);
+}
+
 /* Program the first organism with simple instructions */
 void organism_make_capable(struct organism* o) {
-    unsigned char* vm = o->vm;
+    unsigned char vm[world->config.vm_slots];
+    genome_copy_out(o, vm);
     
     /* Simple code that lets the organism detect things around it and move */
     /*vm[0]   = 255;
@@ -320,89 +1564,162 @@ void organism_make_capable(struct organism* o) {
     vm[750] = 5;
     vm[751] = 85;
     vm[752] = 95;
+    
+    genome_load(o, vm);
 }
 
-/* Returns whether or not an organism collides with a point */
-int organism_collides(struct organism* o, struct location pos) {
-    return pos.x >= o->pos.x
-        && pos.y >= o->pos.y
-        && pos.x <= o->pos.x + o->width
-        && pos.y <= o->pos.y + o->height;
+/* Returns the organism occupying the position, using the occupant index */
+struct organism* organism_that_collides_with_point(struct location pos) {
+    return occupant_get(pos.x, pos.y);
 }
 
-/* Returns an organism that collides with the position */
-struct organism* organism_that_collides_with_point(struct location pos) {
-    unsigned int i;
-    for(i = 0; i < MAX_ORGANISMS; i++) {
-        if(organisms[i] == NULL) break;
-        if(organism_collides(organisms[i], pos)) {
-            return organisms[i];
-        }
+/* A half-open rectangle of tiles, [x0, x1) x [y0, y1). Corners may be off the board. */
+struct tile_rect {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+/* The tiles an organism's body covers */
+struct tile_rect organism_rect(struct organism* o) {
+    struct tile_rect r;
+    r.x0 = o->pos.x - (o->width)/2;
+    r.y0 = o->pos.y - (o->height)/2;
+    r.x1 = o->pos.x + o->width;
+    r.y1 = o->pos.y + o->height;
+    return r;
+}
+
+/* Splits the tiles of a that are not in b into at most four rectangles. Returns how many. */
+int tile_rect_subtract(struct tile_rect a, struct tile_rect b, struct tile_rect* out) {
+    int n = 0;
+    if(b.x0 >= a.x1 || b.x1 <= a.x0 || b.y0 >= a.y1 || b.y1 <= a.y0) { //no overlap
+        out[n++] = a;
+        return n;
     }
-    return NULL;
+    int top    = b.y0 > a.y0 ? b.y0 : a.y0;
+    int bottom = b.y1 < a.y1 ? b.y1 : a.y1;
+    if(a.y0 < top) { //full rows above b
+        out[n].x0 = a.x0; out[n].x1 = a.x1; out[n].y0 = a.y0; out[n].y1 = top;
+        n++;
+    }
+    if(bottom < a.y1) { //full rows below b
+        out[n].x0 = a.x0; out[n].x1 = a.x1; out[n].y0 = bottom; out[n].y1 = a.y1;
+        n++;
+    }
+    if(a.x0 < b.x0) { //left of b, beside it
+        out[n].x0 = a.x0; out[n].x1 = b.x0; out[n].y0 = top; out[n].y1 = bottom;
+        n++;
+    }
+    if(b.x1 < a.x1) { //right of b, beside it
+        out[n].x0 = b.x1; out[n].x1 = a.x1; out[n].y0 = top; out[n].y1 = bottom;
+        n++;
+    }
+    return n;
 }
 
 /*
- * Used as a helper method, returns collision info.
- **************************************************************
- * WARNING: Returned value is malloc'd, make sure to free it! *
- *        (only necessary if collision_check is true)         *
- **************************************************************
-*/
-struct collision_information_bundle* organism_location_write_helper(struct organism* o, enum environmental_tile toWrite, int collision_check) {
-    int startx = o->pos.x - (o->width)/2;
-    int starty = o->pos.y - (o->height)/2;
-    
-    int endx   = o->pos.x + o->width;
-    int endy   = o->pos.y + o->height;
-    
+ * Claims the tiles of r for an organism. If collisions is non-NULL,
+ * occupied tiles are recorded in it (up to MAX_SIMUL_COLL) and left alone,
+ * except food, which is eaten. Tiles the organism already owns are skipped.
+ * Otherwise every tile is overwritten.
+ */
+void organism_rect_write(struct organism* o, struct tile_rect r, struct collision_information_bundle* collisions) {
+    int x;
+    int y;
+    for(x = r.x0; x < r.x1; x++) {
+        for(y = r.y0; y < r.y1; y++) {
+            if(!collisions) {
+                environment_write(x, y, ENVIRONMENT_ORGANISM, o);
+                continue;
+            }
+            enum environmental_tile tile = env_get(x, y);
+            if(tile == ENVIRONMENT_EMPTY) {
+                environment_write(x, y, ENVIRONMENT_ORGANISM, o);
+                continue;
+            }
+            struct organism* other = tile == ENVIRONMENT_ORGANISM ? occupant_get(x, y) : NULL;
+            if(other == o) { //already ours
+                continue;
+            }
+            if(collisions->num == MAX_SIMUL_COLL) { //bundle is full, leave the tile be
+                continue;
+            }
+            struct collision_information* ci = &collisions->collisions[collisions->num++];
+            ci->collidedWith = tile;
+            ci->pos.x = x;
+            ci->pos.y = y;
+            ci->org.index = 0;
+            ci->org.generation = 0;
+            if(other) {
+                ci->org = organism_handle_of(other);
+            }
+            if(tile == ENVIRONMENT_FOOD) {
+                environment_write(x, y, ENVIRONMENT_ORGANISM, o);
+            }
+        }
+    }
+}
+
+/* Empties the tiles of r the organism owns, leaving anything else there alone */
+void organism_rect_clear(struct organism* o, struct tile_rect r) {
     int x;
     int y;
-     
-     if(collision_check) {
-         struct collision_information_bundle* ret = malloc(sizeof(struct collision_information_bundle));
-         for(x = startx; x < endx; x++) {
-             for(y = starty; y < endy; y++) {
-                 if(environment[x][y] != ENVIRONMENT_EMPTY) { //collision!
-                     struct collision_information* ci = &ret->collisions[ret->num++];
-                     ci->collidedWith = environment[x][y];
-                     ci->pos.x = x;
-                     ci->pos.y = y;
-                     if(environment[x][y] == ENVIRONMENT_ORGANISM) {
-                         ci->org = organism_that_collides_with_point(ci->pos);
-                     }
-                 } else {
-                     environment[x][y] = toWrite;
-                 }
-             }
-         }
-         return ret;
-     } else {
-         for(x = startx; x < endx; x++) {
-             for(y = starty; y < endy; y++) {
-                 environment[x][y] = toWrite;
-             }
-         }
-         return NULL;
-     }
+    for(x = r.x0; x < r.x1; x++) {
+        for(y = r.y0; y < r.y1; y++) {
+            if(occupant_get(x, y) == o) {
+                environment_write(x, y, ENVIRONMENT_EMPTY, o);
+            }
+        }
+    }
 }
 
 /* Remove an organism's mass from the location array */
 void organism_clear_location(struct organism* o) {
-    organism_location_write_helper(o, ENVIRONMENT_EMPTY, 0);
+    organism_rect_clear(o, organism_rect(o));
 }
 
-/* Write an organisms's location to the location array */
-struct collision_information_bundle* organism_write_location(struct organism* o) {
-    return organism_location_write_helper(o, ENVIRONMENT_ORGANISM, 1);
+/* Write an organisms's location to the location array, recording collisions into the given bundle */
+struct collision_information_bundle* organism_write_location(struct organism* o, struct collision_information_bundle* collisions) {
+    if(collisions) {
+        collisions->num = 0;
+    }
+    organism_rect_write(o, organism_rect(o), collisions);
+    return collisions;
+}
+
+/*
+ * Brings the location array up to date after an organism's body changed
+ * from before to its current rectangle. Only the strips that differ are
+ * touched, so a one tile step costs the perimeter instead of the area,
+ * and collisions come from the leading strip alone.
+ */
+struct collision_information_bundle* organism_relocate(struct organism* o, struct tile_rect before, struct collision_information_bundle* collisions) {
+    struct tile_rect after = organism_rect(o);
+    struct tile_rect pieces[4];
+    int n;
+    int i;
+    n = tile_rect_subtract(before, after, pieces);
+    for(i = 0; i < n; i++) {
+        organism_rect_clear(o, pieces[i]);
+    }
+    if(collisions) {
+        collisions->num = 0;
+    }
+    n = tile_rect_subtract(after, before, pieces);
+    for(i = 0; i < n; i++) {
+        organism_rect_write(o, pieces[i], collisions);
+    }
+    return collisions;
 }
 
 /* Move organism and write changes to array */
-struct collision_information_bundle* organism_move(int deltax, int deltay, struct organism* o) {
-    organism_clear_location(o);
+struct collision_information_bundle* organism_move(int deltax, int deltay, struct organism* o, struct collision_information_bundle* collisions) {
+    struct tile_rect before = organism_rect(o);
     o->pos.x += deltax;
     o->pos.y += deltay;
-    return organism_write_location(o);
+    return organism_relocate(o, before, collisions);
 }
 
 /* Genertes delta X and Y from speed and direction */
@@ -429,9 +1746,9 @@ struct location direction_to_delta(int speed, enum direction dir) {
 }
 
 /* Moves organism, auto generating delta X and Y based on speed and direction. */
-struct collision_information_bundle* organism_move_auto(int speed, enum direction dir, struct organism* o) {
+struct collision_information_bundle* organism_move_auto(int speed, enum direction dir, struct organism* o, struct collision_information_bundle* collisions) {
     struct location delta = direction_to_delta(speed, dir);
-    return organism_move(delta.x, delta.y, o);
+    return organism_move(delta.x, delta.y, o, collisions);
 }
 
 /* Finds the square the organism is currently "looking at", based on top left */
@@ -476,136 +1793,442 @@ struct location organism_looking_at_end(struct organism* org) {
     return delta;
 }
 
-struct organism* draw_organism = 0;
-void draw_to_console() {
-    if(!draw_organism) {
-        unsigned int i;
-        for(i = 0; i < MAX_ORGANISMS; i++) {
-            if(organisms[i] != 0) {
-                draw_organism = organisms[i];
+/*
+ * Terminal viewer (--view). A renderer thread asks for a frame at most
+ * --fps times a second. The simulation copies the viewport into it
+ * between two ticks and goes straight on, so it never waits on the
+ * terminal. The renderer keeps the last frame it drew and only rewrites
+ * the cells that changed, using cursor positioning escapes. It follows an
+ * organism (--follow ID, or the first one alive) or pans freely: the
+ * arrow keys or hjkl pan, f follows again, n moves to the next organism
+ * and q stops the run.
+ */
+enum viewer_cell {
+    VIEWER_TARGET = 4, //tile of the organism being followed; 0-3 are plain environmental_tiles
+    VIEWER_OFF_BOARD,
+    VIEWER_CELLS
+};
+
+const char viewer_glyphs[VIEWER_CELLS] = {' ', 'O', 'X', 'F', '@', '#'};
+
+enum viewer_state {
+    VIEWER_IDLE,
+    VIEWER_WANTED, //the renderer filled in the request and waits for the simulation
+    VIEWER_READY   //the simulation filled in the frame
+};
+
+struct viewer {
+    atomic_int state;
+    atomic_int quit; //q was pressed
+    atomic_int stop; //set by viewer_stop
+    unsigned int fps;
+
+    /* Request, written by the renderer before it sets VIEWER_WANTED */
+    unsigned int width;
+    unsigned int height;
+    int follow; //center on target rather than use x, y
+    int next;   //move target on to the next organism first
+    int x;      //top left corner of the viewport
+    int y;
+    struct organism_handle target;
+
+    /* Frame, written by the simulation before it sets VIEWER_READY; x, y and target are updated too */
+    unsigned char* cells; //width * height viewer_cells
+    unsigned long long tick;
+    unsigned long long population;
+
+    pthread_t thread;
+    struct termios saved_terminal;
+    int interactive; //stdin is a terminal we can read keys from
+};
+
+struct viewer viewer;
+int viewer_enabled = 0;
+
+/* Live organism at a position of the active list, wrapping around; NULL if there is none */
+struct organism* viewer_pick(unsigned int index) {
+    return world->num_active ? world->active[index % world->num_active] : NULL;
+}
+
+/* Fills a requested frame. Called by the simulation between ticks, so the board holds still. */
+void viewer_capture() {
+    struct organism* target = organism_from_handle(viewer.target);
+    if(!target || viewer.next) {
+        target = viewer_pick(target ? target->active_index + 1 : 0);
+        viewer.next = 0;
+    }
+    if(target) {
+        viewer.target = organism_handle_of(target);
+        if(viewer.follow) {
+            viewer.x = (int)(target->pos.x + target->width/2) - (int)viewer.width/2;
+            viewer.y = (int)(target->pos.y + target->height/2) - (int)viewer.height/2;
+        }
+    }
+    unsigned int i;
+    unsigned int j;
+    unsigned char* cell = viewer.cells;
+    for(j = 0; j < viewer.height; j++) {
+        long y = (long)viewer.y + j;
+        for(i = 0; i < viewer.width; i++) {
+            long x = (long)viewer.x + i;
+            if(x < 0 || y < 0 || x >= world->config.board_width || y >= world->config.board_height) {
+                *cell++ = VIEWER_OFF_BOARD;
+                continue;
             }
+            enum environmental_tile tile = env_get(x, y);
+            *cell++ = tile == ENVIRONMENT_ORGANISM && target && occupant_get(x, y) == target ? VIEWER_TARGET : tile;
         }
-        if(i == MAX_ORGANISMS) {
+    }
+    viewer.tick = world->current_tick;
+    viewer.population = world->organism_births - world->organism_deaths;
+}
+
+/* Hands over a frame if the renderer is waiting for one. Called after every tick. */
+static inline void viewer_tick() {
+    if(viewer_enabled && atomic_load_explicit(&viewer.state, memory_order_acquire) == VIEWER_WANTED) {
+        viewer_capture();
+        atomic_store_explicit(&viewer.state, VIEWER_READY, memory_order_release);
+    }
+}
+
+/* Growable output buffer, flushed with a single write per frame */
+struct viewer_output {
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+void viewer_printf(struct viewer_output* out, const char* format, ...) {
+    for(;;) {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(out->data + out->len, out->cap - out->len, format, args);
+        va_end(args);
+        if(n < 0) {
             return;
         }
-    }
-    char* buff = malloc(columns * rows + 1);
-    buff[columns + rows] = 0;
-    int startx = draw_organism->pos.x + draw_organism->width/2  - columns/2;
-    int starty = draw_organism->pos.y + draw_organism->height/2 - rows/2;
-    
-    int endx = startx + columns;
-    int endy = starty + rows;
-    
-    int index = 0;
-    int x;
-    int y;
-    for(y = starty; y < endy; y++) {
-        for(x = startx; x < endx; x++) {
-            switch(environment[x][y]) {
-                case ENVIRONMENT_EMPTY:
-                    buff[index++] = ' ';
-                    break;
-                case ENVIRONMENT_OBSTACLE:
-                    buff[index++] = 'X';
-                    break;
-                case ENVIRONMENT_ORGANISM:
-                    buff[index++] = 'O';
-                    break;
-                case ENVIRONMENT_FOOD:
-                    buff[index++] = 'F';
-                    break;
-                default:
-                    break;
-            }
+        if(out->len + n < out->cap) {
+            out->len += n;
+            return;
         }
+        out->cap = (out->len + n + 1) * 2;
+        out->data = realloc(out->data, out->cap);
     }
-    printf("%s\n", buff);
-    free(buff);
 }
 
-enum direction direction_rotate_right(enum direction dir) {
-    switch(dir) {
-        case DIRECTION_DOWN:
-            return DIRECTION_LEFT;
-        case DIRECTION_LEFT:
-            return DIRECTION_UP;
-        case DIRECTION_UP:
-            return DIRECTION_RIGHT;
-        case DIRECTION_RIGHT:
-            return DIRECTION_DOWN;
+void viewer_flush(struct viewer_output* out) {
+    size_t done = 0;
+    while(done < out->len) {
+        ssize_t n = write(STDOUT_FILENO, out->data + done, out->len - done);
+        if(n <= 0) {
+            break;
+        }
+        done += n;
     }
+    out->len = 0;
 }
 
-enum direction direction_rotate_left(enum direction dir) {
-    switch(dir) {
-        case DIRECTION_DOWN:
-            return DIRECTION_RIGHT;
-        case DIRECTION_RIGHT:
-            return DIRECTION_UP;
-        case DIRECTION_UP:
-            return DIRECTION_LEFT;
-        case DIRECTION_LEFT:
-            return DIRECTION_DOWN;
+/* Applies the keys waiting on stdin to the renderer's own copy of the request */
+void viewer_keys(int* follow, int* next, int* x, int* y, unsigned int width, unsigned int height) {
+    char keys[32];
+    ssize_t n = read(STDIN_FILENO, keys, sizeof(keys));
+    int step_x = width / 8 ? width / 8 : 1;
+    int step_y = height / 8 ? height / 8 : 1;
+    ssize_t k;
+    for(k = 0; k < n; k++) {
+        char key = keys[k];
+        if(key == 27 && k + 2 < n && keys[k+1] == '[') { //arrow keys
+            key = "kjlh"[keys[k+2] >= 'A' && keys[k+2] <= 'D' ? keys[k+2] - 'A' : 0];
+            k += 2;
+        }
+        switch(key) {
+            case 'h': *x -= step_x; *follow = 0; break;
+            case 'l': *x += step_x; *follow = 0; break;
+            case 'k': *y -= step_y; *follow = 0; break;
+            case 'j': *y += step_y; *follow = 0; break;
+            case 'f': *follow = 1; break;
+            case 'n': *next = 1; *follow = 1; break;
+            case 'q': atomic_store(&viewer.quit, 1); break;
+        }
     }
 }
 
-enum direction direction_inverse(enum direction dir) {
-    switch(dir) {
-        case DIRECTION_DOWN:
-            return DIRECTION_UP;
-        case DIRECTION_UP:
-            return DIRECTION_DOWN;
-        case DIRECTION_LEFT:
-            return DIRECTION_RIGHT;
-        case DIRECTION_RIGHT:
-            return DIRECTION_LEFT;
+/* Waits until deadline (CLOCK_MONOTONIC nanoseconds), handling keys meanwhile. Returns early once stopping. */
+void viewer_wait(unsigned long long deadline, int* follow, int* next, int* x, int* y, unsigned int width, unsigned int height) {
+    for(;;) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        unsigned long long t = now.tv_sec * 1000000000ULL + now.tv_nsec;
+        if(t >= deadline || atomic_load(&viewer.stop) || (deadline == ~0ULL && atomic_load_explicit(&viewer.state, memory_order_acquire) == VIEWER_READY)) {
+            return;
+        }
+        int timeout_ms = deadline - t > 10000000ULL ? 10 : (int)((deadline - t) / 1000000) + 1;
+        struct pollfd in = {STDIN_FILENO, POLLIN, 0};
+        if(viewer.interactive && poll(&in, 1, timeout_ms) > 0) {
+            viewer_keys(follow, next, x, y, width, height);
+        } else if(!viewer.interactive) {
+            struct timespec pause = {0, timeout_ms * 1000000L};
+            nanosleep(&pause, NULL);
+        }
     }
 }
 
-/* Run a specified function a number of times from a starting location, moving forward one tile per time. */
-int run_function_in_direction(int(*func)(struct location), struct location loc, enum direction dir, int length)
-{
-    int destination;
-    struct location current;
-    int val;
+void* viewer_main(void* unused) {
+    unsigned char* last = NULL; //frame on screen
+    unsigned int width = 0;
+    unsigned int height = 0;
+    int follow = viewer.follow;
+    int next = 0;
+    int x = viewer.x;
+    int y = viewer.y;
+    unsigned long long interval = 1000000000ULL / viewer.fps;
+    struct viewer_output out = {NULL, 0, 0};
+    viewer_printf(&out, "\x1b[?1049h\x1b[?25l"); //alternate screen, hide the cursor
+    viewer_flush(&out);
+    while(!atomic_load(&viewer.stop)) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        unsigned long long frame_start = now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+        /* One row is kept for the status line */
+        struct winsize size;
+        unsigned int screen_width = columns;
+        unsigned int screen_height = rows;
+        if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col && size.ws_row) {
+            screen_width = size.ws_col;
+            screen_height = size.ws_row;
+        }
+        if(screen_height < 2) {
+            screen_height = 2;
+        }
+        int redraw = 0;
+        if(screen_width != width || screen_height - 1 != height) {
+            width = screen_width;
+            height = screen_height - 1;
+            free(last);
+            free(viewer.cells);
+            last = malloc(width * height);
+            viewer.cells = malloc(width * height);
+            redraw = 1;
+        }
+
+        /* Ask for a frame and wait for the simulation to fill it in */
+        viewer.width = width;
+        viewer.height = height;
+        viewer.follow = follow;
+        viewer.next = next;
+        next = 0;
+        viewer.x = x;
+        viewer.y = y;
+        atomic_store_explicit(&viewer.state, VIEWER_WANTED, memory_order_release);
+        viewer_wait(~0ULL, &follow, &next, &x, &y, width, height);
+        if(atomic_load_explicit(&viewer.state, memory_order_acquire) != VIEWER_READY) {
+            break;
+        }
+        atomic_store(&viewer.state, VIEWER_IDLE);
+        if(follow && viewer.follow) {
+            x = viewer.x;
+            y = viewer.y;
+        }
+
+        /* Rewrite only the cells that changed; the cursor moves by itself along a run of them */
+        if(redraw) {
+            viewer_printf(&out, "\x1b[2J");
+        }
+        unsigned int i;
+        unsigned int j;
+        int cursor = -1;
+        for(j = 0; j < height; j++) {
+            for(i = 0; i < width; i++) {
+                unsigned int index = j * width + i;
+                unsigned char cell = viewer.cells[index];
+                if(!redraw && cell == last[index]) {
+                    continue;
+                }
+                if(cursor != (int)index) {
+                    viewer_printf(&out, "\x1b[%u;%uH", j + 1, i + 1);
+                }
+                viewer_printf(&out, "%c", viewer_glyphs[cell < VIEWER_CELLS ? cell : 0]);
+                last[index] = cell;
+                cursor = i + 1 < width ? (int)index + 1 : -1;
+            }
+        }
+        char status[256];
+        struct organism_handle target = viewer.target;
+        int n = follow && target.generation
+            ? snprintf(status, sizeof(status), "tick %llu  population %llu  following #%u at %d,%d  (arrows/hjkl pan, n next, q quit)",
+                       viewer.tick, viewer.population, target.index, x + (int)width/2, y + (int)height/2)
+            : snprintf(status, sizeof(status), "tick %llu  population %llu  at %d,%d  (arrows/hjkl pan, f follow, n next, q quit)",
+                       viewer.tick, viewer.population, x + (int)width/2, y + (int)height/2);
+        if(n > (int)width) {
+            status[width] = 0;
+        }
+        viewer_printf(&out, "\x1b[%u;1H\x1b[7m%s\x1b[K\x1b[0m", height + 1, status);
+        viewer_flush(&out);
+
+        viewer_wait(frame_start + interval, &follow, &next, &x, &y, width, height);
+    }
+    viewer_printf(&out, "\x1b[?25h\x1b[?1049l"); //show the cursor, leave the alternate screen
+    viewer_flush(&out);
+    free(out.data);
+    free(last);
+    return NULL;
+}
+
+/* Starts the renderer. follow is an organism slot, or -1 to pan from x, y. */
+int viewer_start(unsigned int fps, int follow, int x, int y) {
+    viewer.fps = fps ? fps : 1;
+    viewer.follow = follow >= 0;
+    viewer.target.index = follow >= 0 ? follow : 0;
+    viewer.target.generation = 0; //resolved to whatever lives in the slot on the first frame
+    viewer.x = x;
+    viewer.y = y;
+    atomic_init(&viewer.state, VIEWER_IDLE);
+    atomic_init(&viewer.quit, 0);
+    atomic_init(&viewer.stop, 0);
+    viewer.interactive = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &viewer.saved_terminal) == 0;
+    if(viewer.interactive) {
+        struct termios raw = viewer.saved_terminal;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    }
+    if(pthread_create(&viewer.thread, NULL, viewer_main, NULL) != 0) {
+        perror("pthread_create");
+        return 0;
+    }
+    viewer_enabled = 1;
+    return 1;
+}
+
+void viewer_stop() {
+    if(!viewer_enabled) {
+        return;
+    }
+    atomic_store(&viewer.stop, 1);
+    pthread_join(viewer.thread, NULL);
+    if(viewer.interactive) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &viewer.saved_terminal);
+    }
+    free(viewer.cells);
+    viewer_enabled = 0;
+}
+
+enum direction direction_rotate_right(enum direction dir) {
     switch(dir) {
         case DIRECTION_DOWN:
-            current.x = loc.x;
-            destination = loc.y + length;
-            for(current.y = loc.y; current.y < destination && current.y < BOARD_HEIGHT; current.y++) {
-                val = func(current);
-                if(val) return val;
-            }
-            break;
+            return DIRECTION_LEFT;
+        case DIRECTION_LEFT:
+            return DIRECTION_UP;
         case DIRECTION_UP:
-            current.x = loc.x;
-            destination = loc.y - length;
-            for(current.y = loc.y; current.y > destination && current.y > -BOARD_HEIGHT; current.y--) {
-                val = func(current);
-                if(val) return val;
-            }
-            break;
+            return DIRECTION_RIGHT;
+        case DIRECTION_RIGHT:
+            return DIRECTION_DOWN;
+    }
+}
+
+enum direction direction_rotate_left(enum direction dir) {
+    switch(dir) {
+        case DIRECTION_DOWN:
+            return DIRECTION_RIGHT;
+        case DIRECTION_RIGHT:
+            return DIRECTION_UP;
+        case DIRECTION_UP:
+            return DIRECTION_LEFT;
         case DIRECTION_LEFT:
-            current.y = loc.y;
-            destination = loc.x - length;
-            for(current.x = loc.x; current.x > destination && current.x > -BOARD_WIDTH; current.x--) {
-                val = func(current);
-                if(val) return val;
-            }
-            break;
+            return DIRECTION_DOWN;
+    }
+}
+
+enum direction direction_inverse(enum direction dir) {
+    switch(dir) {
+        case DIRECTION_DOWN:
+            return DIRECTION_UP;
+        case DIRECTION_UP:
+            return DIRECTION_DOWN;
+        case DIRECTION_LEFT:
+            return DIRECTION_RIGHT;
         case DIRECTION_RIGHT:
-            current.y = loc.y;
-            destination = loc.x + length;
-            for(current.x = loc.x; current.x < destination && current.x < BOARD_WIDTH; current.x++) {
-                val = func(current);
-                if(val) return val;
-            }
-            break;
+            return DIRECTION_LEFT;
+    }
+}
+
+/*
+ * Set by --reference-interpreter. Besides the switch interpreter this also
+ * makes the sensing opcodes walk their rays tile by tile instead of using
+ * the bit planes, so the two can be checked against each other.
+ */
+int use_reference_interpreter = 0;
+
+/*
+ * Run a specified function a number of times from a starting location, moving forward one tile per time.
+ * Stops at the edge of the board; coordinates wrap below zero, so UP and LEFT stop there too.
+ */
+int run_function_in_direction(int(*func)(struct location), struct location loc, enum direction dir, int length)
+{
+    struct location step = direction_to_delta(1, dir);
+    int val;
+    int i;
+    for(i = 0; i < length && loc.x < world->config.board_width && loc.y < world->config.board_height; i++) {
+        val = func(loc);
+        if(val) return val;
+        loc.x += step.x;
+        loc.y += step.y;
     }
     return 0;
 }
 
+/*
+ * Distance to the first tile of a plane along a ray of up to length tiles
+ * from (x, y), or -1 if there is none before the ray ends or leaves the
+ * board. Same tiles as run_function_in_direction, one word per block.
+ */
+int env_ray_scan(int plane, unsigned int x, unsigned int y, enum direction dir, int length) {
+    if(x >= world->config.board_width || y >= world->config.board_height || length <= 0) {
+        return -1;
+    }
+    int horizontal = dir == DIRECTION_LEFT || dir == DIRECTION_RIGHT;
+    unsigned int start = horizontal ? x : y;
+    unsigned int extent = horizontal ? world->config.board_width : world->config.board_height;
+    unsigned int at = start;
+    unsigned long long word;
+    if(dir == DIRECTION_RIGHT || dir == DIRECTION_DOWN) {
+        unsigned int end = start + length < extent ? start + length : extent;
+        while(at < end) {
+            unsigned int bit = at & ENV_BLOCK_MASK;
+            unsigned int span = end - at < ENV_BLOCK_SIZE - bit ? end - at : ENV_BLOCK_SIZE - bit;
+            word = env_plane_word(plane, horizontal, horizontal ? at : x, horizontal ? y : at) >> bit;
+            if(span < ENV_BLOCK_SIZE) {
+                word &= (1ULL << span) - 1;
+            }
+            if(word) {
+                return at + __builtin_ctzll(word) - start;
+            }
+            at += span;
+        }
+    } else {
+        unsigned int stop = start + 1 > (unsigned int)length ? start + 1 - length : 0; //last tile on the ray
+        for(;;) {
+            unsigned int bit = at & ENV_BLOCK_MASK;
+            unsigned int base = at - bit;
+            word = env_plane_word(plane, horizontal, horizontal ? at : x, horizontal ? y : at);
+            word &= ~0ULL >> (63 - bit);
+            if(base < stop) {
+                word &= ~0ULL << (stop - base);
+            }
+            if(word) {
+                return start - (base + 63 - __builtin_clzll(word));
+            }
+            if(base <= stop) {
+                break;
+            }
+            at = base - 1;
+        }
+    }
+    return -1;
+}
+
 /* Returns organism size */
 int organism_size(struct organism* org) {
     return org->width * org->height;
@@ -613,7 +2236,7 @@ int organism_size(struct organism* org) {
 
 /* A function that detects if an organism exists at a location. If it does, it returns its size. Else, 0. */
 int organism_size_at_location(struct location l) {
-    if(environment[l.x][l.y] == ENVIRONMENT_ORGANISM) {
+    if(env_get(l.x, l.y) == ENVIRONMENT_ORGANISM) {
         struct organism* o = organism_that_collides_with_point(l);
         if(o) {
             return organism_size(o);
@@ -626,7 +2249,7 @@ int organism_size_at_location(struct location l) {
 
 /* A function that tells whether or not the specified location is an obstacle */
 int obstacle_exists_at_location(struct location l) {
-    if(environment[l.x][l.y] == ENVIRONMENT_OBSTACLE) {
+    if(env_get(l.x, l.y) == ENVIRONMENT_OBSTACLE) {
         return 1;
     }
     return 0;
@@ -658,72 +2281,122 @@ int organism_looking_at_searcher(struct organism* org, int(*func)(struct locatio
      *                      |___________________|
      */
     
-    /* Now we repeatedly loop checking for organisms in that direction */
-    unsigned int* to_modify;
-    struct location* loc_being_modified;
-    unsigned int max;
-    if(loc.x == loc2.x) { //we're looping on y axis
-        if(loc.y > loc2.y) { //start from loc2 and increment to loc
-            to_modify = &loc2.y;
-            max = loc.y;
-            loc_being_modified = &loc2;
-        } else { //start from loc and increment to loc2
-            to_modify = &loc.y;
-            max = loc.y;
-            loc_being_modified = &loc;
-        }
-    } else { //we're looping on x axis
-        if(loc.x > loc2.x) { //start from loc2 and increment to loc
-            to_modify = &loc2.x;
-            max = loc.x;
-            loc_being_modified = &loc2;
-        } else { //start from loc and increment to loc2
-            to_modify = &loc.x;
-            max = loc2.x;
-            loc_being_modified = &loc;
-        }
-    }
-    int result = -1;
+    /* Now we repeatedly loop checking for organisms in that direction, S and E included */
+    int result = 0;
     int temp;
-    if(exists) { //check if something exists
-        while(*to_modify < max) {
-            if((result = run_function_in_direction(func, *loc_being_modified, org->dir, SEARCH_DIST))) {
-                return result;
-            }
-            (*to_modify)++;
+    for(;;) {
+        temp = run_function_in_direction(func, loc, org->dir, world->config.search_dist);
+        if(exists && temp) { //check if something exists
+            return temp;
         }
-    } else { //find max
-        while(*to_modify < max) {
-            temp = run_function_in_direction(func, *loc_being_modified, org->dir, SEARCH_DIST);
-            if(temp > result) { //found a bigger value
-                result = temp;
-            }
-            (*to_modify)++;
+        if(temp > result) { //found a bigger value
+            result = temp;
+        }
+        if(loc.x == loc2.x && loc.y == loc2.y) {
+            return result;
+        }
+        if(loc.x != loc2.x) { //we're looping on x axis
+            loc.x++;
+        } else { //we're looping on y axis
+            loc.y++;
+        }
+    }
+}
+
+/* First organism along a ray of up to length tiles from l, or NULL */
+struct organism* env_ray_organism(struct location l, enum direction dir, int length) {
+    struct location step = direction_to_delta(1, dir);
+    int plane = env_plane(ENVIRONMENT_ORGANISM);
+    int distance;
+    while((distance = env_ray_scan(plane, l.x, l.y, dir, length)) >= 0) {
+        l.x += step.x * distance;
+        l.y += step.y * distance;
+        struct organism* o = organism_that_collides_with_point(l);
+        if(o) {
+            return o;
+        }
+        l.x += step.x;
+        l.y += step.y;
+        length -= distance + 1;
+    }
+    return NULL;
+}
+
+/* Bit plane version of organism_looking_at_searcher looking for a tile type */
+int organism_looking_at_tile(struct organism* org, enum environmental_tile tile) {
+    struct location loc = organism_looking_at(org);
+    struct location loc2 = organism_looking_at_end(org);
+    int plane = env_plane(tile);
+    for(;;) {
+        if(env_ray_scan(plane, loc.x, loc.y, org->dir, world->config.search_dist) >= 0) {
+            return 1;
+        }
+        if(loc.x == loc2.x && loc.y == loc2.y) {
+            return 0;
+        }
+        if(loc.x != loc2.x) {
+            loc.x++;
+        } else {
+            loc.y++;
         }
-        return result;
     }
-    return 0;
 }
 
 /*
- * If an organism is looking at another organism within SEARCH_DIST, return its size.
+ * If an organism is looking at another organism within config.search_dist, return its size.
  * If none, return 0.
  * If multiple organisms, returns size of max.
  */
 int organism_looking_at_organism_size(struct organism* org) {
-    return organism_looking_at_searcher(org, organism_size_at_location, 0);
+    if(use_reference_interpreter) {
+        return organism_looking_at_searcher(org, organism_size_at_location, 0);
+    }
+    struct location loc = organism_looking_at(org);
+    struct location loc2 = organism_looking_at_end(org);
+    int result = 0;
+    for(;;) {
+        struct organism* o = env_ray_organism(loc, org->dir, world->config.search_dist);
+        if(o && organism_size(o) > result) {
+            result = organism_size(o);
+        }
+        if(loc.x == loc2.x && loc.y == loc2.y) {
+            return result;
+        }
+        if(loc.x != loc2.x) {
+            loc.x++;
+        } else {
+            loc.y++;
+        }
+    }
 }
 
 /* Returns 1 if food exists at location, else 0. */
 int food_exists_at_location(struct location l) {
-    if(environment[l.x][l.y] == ENVIRONMENT_FOOD) {
+    if(env_get(l.x, l.y) == ENVIRONMENT_FOOD) {
         return 1;
     }
     return 0;
 }
 
-/* Grow in direction specified by org->dir */
-void organism_grow(struct organism* org) {
+/* Returns 1 if the organism is looking at food within config.search_dist, else 0 */
+int organism_looking_at_food(struct organism* org) {
+    if(use_reference_interpreter) {
+        return organism_looking_at_searcher(org, food_exists_at_location, 1);
+    }
+    return organism_looking_at_tile(org, ENVIRONMENT_FOOD);
+}
+
+/* Returns 1 if the organism is looking at an obstacle within config.search_dist, else 0 */
+int organism_looking_at_obstacle(struct organism* org) {
+    if(use_reference_interpreter) {
+        return organism_looking_at_searcher(org, obstacle_exists_at_location, 1);
+    }
+    return organism_looking_at_tile(org, ENVIRONMENT_OBSTACLE);
+}
+
+/* Grow in direction specified by org->dir, claiming the new tiles */
+struct collision_information_bundle* organism_grow(struct organism* org, struct collision_information_bundle* collisions) {
+    struct tile_rect before = organism_rect(org);
     switch(org->dir) {
         case DIRECTION_DOWN:
             org->height++;
@@ -740,6 +2413,7 @@ void organism_grow(struct organism* org) {
             org->width++;
             break;
     }
+    return organism_relocate(org, before, collisions);
 }
 
 /* If an organism exists at location l, remove 1 food from it. Return 1 if successful. */
@@ -752,355 +2426,2817 @@ int fire_upon_organism(struct location l) {
     return 0;
 }
 
-/* Run one bytecode instruction */
-struct collision_information_bundle* bytecode_tick(struct organism* org, unsigned int loe_index) {
-    /*
-     * Cache frequently used vars.
-     * Remember, as soon as the below if/else chain executes, the
-     * instruction pointer and instructionare no longer valid,
-     * because they may have been updated.
-     */
-    struct context_info* execution_context = &org->loe[loe_index];
-    unsigned int i_ptr = execution_context->i_ptr;
-    unsigned char instruction = org->vm[i_ptr];
-    
-    /* Stores any necessary collision information */
-    struct collision_information_bundle* collision = NULL;
-    
-    printf("Organism %d: ", org->id);
-    if(instruction <= 10) { //increment pointer
-        execution_context->ptr++;
-        printf("INC\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 20) { //decrement pointer
-        execution_context->ptr--;
-        printf("DEC\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 30) { //increment *pointer
-        org->vm[execution_context->ptr]++;
-        printf("*INC\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 40) { //decrement *pointer
-        org->vm[execution_context->ptr]--;
-        printf("*DEC\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 50) { //turn right
-        org->dir   = direction_rotate_right(org->dir);
-        org->food -= 1;
-        printf("RIGHT\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 60) { //turn left
-        org->dir   = direction_rotate_left(org->dir);
-        org->food -= 1;
-        printf("LEFT\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 70) { //move forward
-        //int speed = (instruction-1) % 10;
-        collision = organism_move_auto(1, org->dir, org);
-        org->food -= 1;
-        printf("FORWARD\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 80) { //move backward
-        //int speed = (instruction-1) % 10;
-        collision = organism_move_auto(1, direction_inverse(org->dir), org);
-        org->food -= 1;
-        printf("BACK\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 90) { //while(*ptr > 0) {
-        printf("WHILE {");
-        if(org->vm[execution_context->ptr] > 0) { //loop condition satisfied
-            printf(" SATISFIED");
-            organism_print(org);
-            //PAUSE_FROM_STACKOVERFLOW();
-            if(++(execution_context->loop_level) > MAX_LOOP_LEVEL) { //too many nested loops!
-                printf("Too many nested loops on organism %u.\n", org->id);
-                execution_context->loop_level--; //restore and do nothing
-            } else {
-                /*
-                 * Save current location so we can jump back to it later if it is
-                 * necessary to restart the loop.
-                 */
-                execution_context->prevAddresses[execution_context->loop_level - 1] = i_ptr;
-            }
-        } else { //jump to end of loop
-            printf("  END");
-            /* While not end bracket */
-            while(instruction < 91 || instruction > 100) {
-                i_ptr++;
-                instruction = org->vm[i_ptr];
-            }
-        }
-        printf("\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 100) { //}
-        if(execution_context->loop_level > 0) { //we're actually in a loop
-            if(org->vm[execution_context->ptr] > 0) { //loop condition satisfied
-                execution_context->i_ptr = execution_context->prevAddresses[execution_context->loop_level-1];
-            } else { //exit loop
-                printf("EXIT_LOOP\n");
-                //PAUSE_FROM_STACKOVERFLOW();
-                execution_context->loop_level--;
-            }
-        }
-        printf("}\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 110) { //detect creature and save size to ptr
-        int size = organism_looking_at_organism_size(org);
-        /* Save to *ptr */
-        org->vm[execution_context->ptr] = size;
-        printf("DETECT\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 120) { //detect creature and then save 1 if exists, or 0 if not
-        int organism_exists = organism_looking_at_organism_size(org) == 0 ? 0 : 1;
-        org->vm[execution_context->ptr] = organism_exists;
-        printf("BIN DETECT\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 130) { //store *ptr in register (instruction-1) % 10
-        int reg = (instruction-1) % 10;
-        if(reg < NUM_REG) { //store in per-LOE register
-            execution_context->reg[reg] = org->vm[execution_context->ptr];
-        } else { //store in shared register
-            org->shared_reg = org->vm[execution_context->ptr];
-        }
-        printf("*PTR -> REG %d\n", reg);
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 140) { //store register (instruction-1) % 10 to *ptr
-        int reg = (instruction-1) % 10;
-        if(reg < NUM_REG) { //store in per-LOE register
-            org->vm[execution_context->ptr] = execution_context->reg[reg];
-        } else { //store in shared register
-            org->vm[execution_context->ptr] = org->shared_reg;
-        }
-        printf("REG %d -> *ptr\n", reg);
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 150) { //jump to ptr offset
-        execution_context->i_ptr += (execution_context->ptr - 128);
-        printf("JMP\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 160) { //grow in direction
-        organism_grow(org);
-        if(org->dir == DIRECTION_LEFT || org->dir == DIRECTION_RIGHT) {
-            org->food -= org->height * 15;
-        } else {
-            org->food -= org->width * 15;
-        }
-        printf("GROW\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 170) { //if *ptr > 0, *ptr = 1
-        if(org->vm[execution_context->ptr] > 0) {
-            org->vm[execution_context->ptr] = 1;
-        }
-        printf("IF *PTR > 0, *PTR = 1\n");
-    } else if(instruction <= 180) { //detect obstacle and save 0 or 1 to *ptr
-        org->vm[execution_context->ptr] = organism_looking_at_searcher(org, food_exists_at_location, 1);
-        printf("DETECT OBSTACLE\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 190) { //store vm[i_ptr+1] in *ptr
-        org->vm[execution_context->ptr] = org->vm[execution_context->i_ptr+1];
-        printf("vm[i_ptr] -> *ptr\n");
-    } else if(instruction <= 200) { //make *ptr random
-        org->vm[execution_context->ptr] = (unsigned char)rand();
-        printf("Rand -> *ptr\n");
-    } else if(instruction <= 210) { //set ptr to i_ptr
-        execution_context->ptr = execution_context->i_ptr;
-        printf("ptr -> i_ptr\n");
-    } else if(instruction <= 220) { //fire; lose energy
-        run_function_in_direction(fire_upon_organism, organism_looking_at(org), org->dir, SEARCH_DIST);
-        org->food--;
-        printf("Fire\n");
-    } else if(instruction <= 230) { //detect food ahead, save 0 or 1 to *ptr
-        org->vm[execution_context->ptr] = organism_looking_at_searcher(org, food_exists_at_location, 1);
-        printf("DETECT FOOD\n");
-        //PAUSE_FROM_STACKOVERFLOW();
-    } else if(instruction <= 240) { //store current location mod 256 in organism
-        org->vm[execution_context->ptr] = (unsigned char)(org->pos.x % 256);
-        if(execution_context->ptr+1 < VM_SLOTS) {
-            org->vm[execution_context->ptr+1] = (unsigned char)(org->pos.y % 256);
-        }
-        printf("Store location\n");
-    } //otherwise, do nothing
-    
+/* Fires along the ray from the organism's top left "looking at" square */
+void organism_fire(struct organism* org) {
+    if(use_reference_interpreter) {
+        run_function_in_direction(fire_upon_organism, organism_looking_at(org), org->dir, world->config.search_dist);
+        return;
+    }
+    struct organism* o = env_ray_organism(organism_looking_at(org), org->dir, world->config.search_dist);
+    if(o) {
+        o->food--;
+    }
+}
+
+/*
+ * Opcode handlers. Each one runs a single decoded instruction for one LOE.
+ * Collisions are recorded into the caller's bundle, which is returned if
+ * any could have happened. Both interpreters below share these, so they
+ * only differ in how the instruction byte is decoded.
+ *
+ * Every kernel (see organism_loop) passes the handlers its vm_shape. The
+ * preset kernels pass literals, so once the handlers are inlined their
+ * bounds checks compare against constants again.
+ */
+struct vm_shape {
+    unsigned int vm_slots;
+    unsigned int num_loe;
+    unsigned int num_reg;
+};
+
+/* Shape of the running configuration, for the generic kernel */
+static inline struct vm_shape config_shape() {
+    struct vm_shape shape = {world->config.vm_slots, world->config.num_loe, world->config.num_reg};
+    return shape;
+}
+
+typedef struct collision_information_bundle* (*opcode_handler)(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape);
+
+static inline struct collision_information_bundle* op_inc(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //increment pointer
+    execution_context->ptr++;
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_dec(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //decrement pointer
+    execution_context->ptr--;
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_inc_at(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //increment *pointer
+    vm_write(org, execution_context->ptr, vm_read(org, execution_context->ptr) + 1, shape.vm_slots);
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_dec_at(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //decrement *pointer
+    vm_write(org, execution_context->ptr, vm_read(org, execution_context->ptr) - 1, shape.vm_slots);
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_right(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //turn right
+    org->dir   = direction_rotate_right(org->dir);
+    org->food -= 1;
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_left(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //turn left
+    org->dir   = direction_rotate_left(org->dir);
+    org->food -= 1;
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_forward(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //move forward
+    //int speed = (instruction-1) % 10;
+    struct collision_information_bundle* collision = organism_move_auto(1, org->dir, org, collisions);
+    org->food -= 1;
     return collision;
 }
 
-/* Fixes up VM pointers and returns 0 if organism doesn't have enough food to survive. */
-int organism_checkup(struct organism* org) {
-    unsigned int loe_index;
-    for(loe_index = 0; loe_index < NUM_LOE; loe_index++) {
-        struct context_info* execution_context = &org->loe[loe_index];
-        if(execution_context->ptr > VM_SLOTS) {
-            execution_context->ptr = 0;
-        }
-        if(execution_context->i_ptr > VM_SLOTS) {
-            execution_context->i_ptr = 0;
-        }
-    }
-    return org->food < 0 ? 0 : 1;
+static inline struct collision_information_bundle* op_back(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //move backward
+    //int speed = (instruction-1) % 10;
+    struct collision_information_bundle* collision = organism_move_auto(1, direction_inverse(org->dir), org, collisions);
+    org->food -= 1;
+    return collision;
 }
 
-/* Handle an organism's collision. Returns 1 if organism is now deleted. */
-int handle_collision(struct organism* org, struct collision_information* info) {
-    if(info->collidedWith == ENVIRONMENT_ORGANISM) { // collided with organism
-        if(organism_size(info->org) > organism_size(org)) { //organism collided with is bigger
-            org->food += info->org->food;
-            org->food += organism_size(info->org) / ORG_TO_FOOD;
-            organism_delete(info->org, 1);
-            return 0;
-        } else { //we're bigger
-            info->org->food += org->food;
-            info->org->food += organism_size(org) / ORG_TO_FOOD;
-            organism_delete(org, 2);
-            return 1;
+static inline struct collision_information_bundle* op_while(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //while(*ptr > 0) {
+    unsigned int i_ptr = execution_context->i_ptr;
+    if(vm_read(org, execution_context->ptr) > 0) { //loop condition satisfied
+        if(++(execution_context->loop_level) > MAX_LOOP_LEVEL) { //too many nested loops!
+            TRACE(TRACE_INSTRUCTIONS, org->id, TRACE_LOOP_LIMIT, 0, 0, 0, 0, 0);
+            execution_context->loop_level--; //restore and do nothing
+        } else {
+            /*
+             * Save current location so we can jump back to it later if it is
+             * necessary to restart the loop.
+             */
+            execution_context->prevAddresses[execution_context->loop_level - 1] = i_ptr;
         }
-    } else if(info->collidedWith == ENVIRONMENT_OBSTACLE) {
-        org->food--;
-        if(org->food <= 0) {
-            organism_delete(org, 3);
-            return 1;
+    } else { //jump to end of loop
+        if(!org->brackets || org->brackets_dirty) {
+            organism_match_brackets(org);
+        }
+        /* Land on the matching END; the loop then steps past it. With no match, carry on. */
+        if(i_ptr < shape.vm_slots && org->brackets->match[i_ptr] < shape.vm_slots) {
+            execution_context->i_ptr = org->brackets->match[i_ptr];
         }
-    } else if(info->collidedWith == ENVIRONMENT_FOOD) {
-        org->food+=50;
     }
-    return 0;
+    return NULL;
 }
 
-/* Perform intentionally lossy copy of organism's VM */
-void organism_lossy_copy(struct organism* first, struct organism* second) {
-    int i;
-    for(i = 0; i < VM_SLOTS; i++) {
-        unsigned char c = first->vm[i];
-        int r = rand() % 1024;
-        /* Perform mutations */
-        if(r == 0) { //subtract one
-            second->vm[i] = c-1;
-        } else if(r == 1) { //add one
-            second->vm[i] = c+1;
-        } else if(r == 2) { //subtract/add up to 25
-            second->vm[i] = (unsigned char)(c+(rand()%25));
-        } else if(r == 3) { //completely random instruction
-            second->vm[i] = (unsigned char)rand();
-        } else if(r == 4) {} //do nothing
-        else { //actually copy
-            second->vm[i] = c;
+static inline struct collision_information_bundle* op_end(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //}
+    if(execution_context->loop_level > 0) { //we're actually in a loop
+        if(vm_read(org, execution_context->ptr) > 0) { //loop condition satisfied
+            execution_context->i_ptr = execution_context->prevAddresses[execution_context->loop_level-1];
+        } else { //exit loop
+            execution_context->loop_level--;
         }
     }
+    return NULL;
 }
 
-/* Reproduce and kill organism */
-void organism_reproduce(struct organism* org) {
-    //Artifical reproduction for now
-    //TODO: org->loe[0]->i_ptr = ORG_REPRODUCE;
-    printf("Reproduction shall occur, organism: %d\n", org->id);
-    if(org->food < ORG_FOOD) { //organism failed at life, delete & abort
-        printf("    Failed at life, delete + abort.\n");
-        organism_delete(org, 4);
-        return;
-    }
-    int offset = org->width + 15;
-    while(org->food > ORG_FOOD/2) {
-        printf("    Creating new organism.\n");
-        struct organism* o = organism_factory();
-        struct location new_location = org->pos;
-        new_location.x += offset;
-        offset += offset;
-        o->pos = new_location;
-        o->food += ORG_FOOD*2;
-        org->food -= ORG_FOOD*2;
-        struct collision_information_bundle* cib = organism_write_location(org);
-        if(cib) {
-            free(cib);
-        }
-        organism_lossy_copy(org, o);
-        printf("      Organism created:\n------BEGIN PRINT-------");
-        organism_print(o);
-        printf("---------END ORGANISM PRINT---------\n");
+static inline struct collision_information_bundle* op_detect(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //detect creature and save size to ptr
+    int size = organism_looking_at_organism_size(org);
+    /* Save to *ptr */
+    vm_write(org, execution_context->ptr, size, shape.vm_slots);
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_bin_detect(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //detect creature and then save 1 if exists, or 0 if not
+    int organism_exists = organism_looking_at_organism_size(org) == 0 ? 0 : 1;
+    vm_write(org, execution_context->ptr, organism_exists, shape.vm_slots);
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_ptr_to_reg(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //store *ptr in register (instruction-1) % 10
+    int reg = (instruction-1) % 10;
+    if(reg < shape.num_reg) { //store in per-LOE register
+        execution_context->reg[reg] = vm_read(org, execution_context->ptr);
+    } else { //store in shared register
+        org->shared_reg = vm_read(org, execution_context->ptr);
     }
-    organism_delete(org, 5);
+    return NULL;
 }
 
-/* Runs each organism threads, does checkups (removing if dead), and performs food ticks */
-void organism_loop(struct organism* org) {
-    printf("Loop: %d\n", org->id);
-    /* Pre bytecode checkup, in case affected by another organism */
-    if(!organism_checkup(org)) {
-        organism_delete(org, 6);
-        return;
+static inline struct collision_information_bundle* op_reg_to_ptr(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //store register (instruction-1) % 10 to *ptr
+    int reg = (instruction-1) % 10;
+    if(reg < shape.num_reg) { //store in per-LOE register
+        vm_write(org, execution_context->ptr, execution_context->reg[reg], shape.vm_slots);
+    } else { //store in shared register
+        vm_write(org, execution_context->ptr, org->shared_reg, shape.vm_slots);
     }
-    /* Run each LOE in order */
-    unsigned int loe_index;
-    for(loe_index = 0; loe_index < NUM_LOE; loe_index++) {
-        struct collision_information_bundle* collision = bytecode_tick(org, loe_index);
-        if(collision) { //the organism collided with something!
-            unsigned int i;
-            for(i = 0; i < collision->num; i++) {
-                if(handle_collision(org, &collision->collisions[i])) {
-                    free(collision);
-                    return;
-                }
-            }
-            free(collision);
-        }
-        /* Increment organism's instruction pointer */
-        (org->loe[loe_index].i_ptr)++;
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_jmp(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //jump to ptr offset
+    execution_context->i_ptr += (execution_context->ptr - 128);
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_grow(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //grow in direction
+    struct collision_information_bundle* collision = organism_grow(org, collisions);
+    if(org->dir == DIRECTION_LEFT || org->dir == DIRECTION_RIGHT) {
+        org->food -= org->height * 15;
+    } else {
+        org->food -= org->width * 15;
     }
-    /* Increment organism tick */
-    org->ticks_since_birth++;
-    /* Check if needs to be hungry */
-    if(org->ticks_since_birth % ORG_HUNGER == 0) {
-        /* Get hungry! */
-        (org->food)--;
+    return collision;
+}
+
+static inline struct collision_information_bundle* op_bool(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //if *ptr > 0, *ptr = 1
+    if(vm_read(org, execution_context->ptr) > 0) {
+        vm_write(org, execution_context->ptr, 1, shape.vm_slots);
     }
-    /* Check if needs to die and reproduce */
-    if(org->ticks_since_birth > ORG_LIFESPAN) {
-        organism_reproduce(org);
-    } else {
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_detect_obstacle(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //detect obstacle and save 0 or 1 to *ptr
+    vm_write(org, execution_context->ptr, organism_looking_at_obstacle(org), shape.vm_slots);
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_load_next(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //store vm[i_ptr+1] in *ptr
+    unsigned int next = execution_context->i_ptr + 1 < shape.vm_slots ? execution_context->i_ptr + 1 : 0; //the genome wraps like i_ptr does
+    vm_write(org, execution_context->ptr, vm_read(org, next), shape.vm_slots);
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_rand(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //make *ptr random
+    vm_write(org, execution_context->ptr, (unsigned char)rng_next(&org->rng), shape.vm_slots);
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_ptr_from_ip(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //set ptr to i_ptr
+    execution_context->ptr = execution_context->i_ptr;
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_fire(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //fire; lose energy
+    organism_fire(org);
+    org->food--;
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_detect_food(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //detect food ahead, save 0 or 1 to *ptr
+    vm_write(org, execution_context->ptr, organism_looking_at_food(org), shape.vm_slots);
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_store_location(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //store current location mod 256 in organism
+    vm_write(org, execution_context->ptr, (unsigned char)(org->pos.x % 256), shape.vm_slots);
+    if(execution_context->ptr+1 < shape.vm_slots) {
+        vm_write(org, execution_context->ptr+1, (unsigned char)(org->pos.y % 256), shape.vm_slots);
+    }
+    return NULL;
+}
+
+static inline struct collision_information_bundle* op_nop(struct organism* org, struct context_info* execution_context, unsigned char instruction, struct collision_information_bundle* collisions, const struct vm_shape shape) { //do nothing
+    return NULL;
+}
+
+
+/*
+ * Reference interpreter: decodes with a plain switch over the raw
+ * instruction byte. Slower, but kept so the threaded interpreter can be
+ * cross-checked against it (run both with the same --seed).
+ */
+static inline __attribute__((always_inline)) struct collision_information_bundle* bytecode_tick_reference(struct organism* org, unsigned int loe_index, struct collision_information_bundle* collisions, const struct vm_shape shape) {
+    struct context_info* execution_context = &org->loe[loe_index];
+    unsigned char instruction = vm_fetch(org, execution_context);
+
+    TRACE(TRACE_INSTRUCTIONS, org->id, TRACE_INSTRUCTION, instruction, execution_context->i_ptr, execution_context->ptr, 0, 0);
+    switch(instruction) {
+        case 0 ... 10:    return op_inc(org, execution_context, instruction, collisions, shape);
+        case 11 ... 20:   return op_dec(org, execution_context, instruction, collisions, shape);
+        case 21 ... 30:   return op_inc_at(org, execution_context, instruction, collisions, shape);
+        case 31 ... 40:   return op_dec_at(org, execution_context, instruction, collisions, shape);
+        case 41 ... 50:   return op_right(org, execution_context, instruction, collisions, shape);
+        case 51 ... 60:   return op_left(org, execution_context, instruction, collisions, shape);
+        case 61 ... 70:   return op_forward(org, execution_context, instruction, collisions, shape);
+        case 71 ... 80:   return op_back(org, execution_context, instruction, collisions, shape);
+        case 81 ... 90:   return op_while(org, execution_context, instruction, collisions, shape);
+        case 91 ... 100:  return op_end(org, execution_context, instruction, collisions, shape);
+        case 101 ... 110: return op_detect(org, execution_context, instruction, collisions, shape);
+        case 111 ... 120: return op_bin_detect(org, execution_context, instruction, collisions, shape);
+        case 121 ... 130: return op_ptr_to_reg(org, execution_context, instruction, collisions, shape);
+        case 131 ... 140: return op_reg_to_ptr(org, execution_context, instruction, collisions, shape);
+        case 141 ... 150: return op_jmp(org, execution_context, instruction, collisions, shape);
+        case 151 ... 160: return op_grow(org, execution_context, instruction, collisions, shape);
+        case 161 ... 170: return op_bool(org, execution_context, instruction, collisions, shape);
+        case 171 ... 180: return op_detect_obstacle(org, execution_context, instruction, collisions, shape);
+        case 181 ... 190: return op_load_next(org, execution_context, instruction, collisions, shape);
+        case 191 ... 200: return op_rand(org, execution_context, instruction, collisions, shape);
+        case 201 ... 210: return op_ptr_from_ip(org, execution_context, instruction, collisions, shape);
+        case 211 ... 220: return op_fire(org, execution_context, instruction, collisions, shape);
+        case 221 ... 230: return op_detect_food(org, execution_context, instruction, collisions, shape);
+        case 231 ... 240: return op_store_location(org, execution_context, instruction, collisions, shape);
+        default:          return op_nop(org, execution_context, instruction, collisions, shape); //otherwise, do nothing
+    }
+}
+
+/*
+ * Run one bytecode instruction. The instruction byte indexes a 256-entry
+ * table of label addresses built at compile time, so decoding is a single
+ * indirect jump whatever the opcode. Computed gotos can't be inlined, so
+ * this is stamped out once per kernel with DEFINE_BYTECODE_TICK instead.
+ */
+#define DEFINE_BYTECODE_TICK(name, shape_value) \
+struct collision_information_bundle* name(struct organism* org, unsigned int loe_index, struct collision_information_bundle* collisions) { \
+    const struct vm_shape shape = shape_value;                                                                                             \
+    static const void* const dispatch[256] = {                                                                                             \
+        [0 ... 10]    = &&op_inc,                                                                                                          \
+        [11 ... 20]   = &&op_dec,                                                                                                          \
+        [21 ... 30]   = &&op_inc_at,                                                                                                       \
+        [31 ... 40]   = &&op_dec_at,                                                                                                       \
+        [41 ... 50]   = &&op_right,                                                                                                        \
+        [51 ... 60]   = &&op_left,                                                                                                         \
+        [61 ... 70]   = &&op_forward,                                                                                                      \
+        [71 ... 80]   = &&op_back,                                                                                                         \
+        [81 ... 90]   = &&op_while,                                                                                                        \
+        [91 ... 100]  = &&op_end,                                                                                                          \
+        [101 ... 110] = &&op_detect,                                                                                                       \
+        [111 ... 120] = &&op_bin_detect,                                                                                                   \
+        [121 ... 130] = &&op_ptr_to_reg,                                                                                                   \
+        [131 ... 140] = &&op_reg_to_ptr,                                                                                                   \
+        [141 ... 150] = &&op_jmp,                                                                                                          \
+        [151 ... 160] = &&op_grow,                                                                                                         \
+        [161 ... 170] = &&op_bool,                                                                                                         \
+        [171 ... 180] = &&op_detect_obstacle,                                                                                              \
+        [181 ... 190] = &&op_load_next,                                                                                                    \
+        [191 ... 200] = &&op_rand,                                                                                                         \
+        [201 ... 210] = &&op_ptr_from_ip,                                                                                                  \
+        [211 ... 220] = &&op_fire,                                                                                                         \
+        [221 ... 230] = &&op_detect_food,                                                                                                  \
+        [231 ... 240] = &&op_store_location,                                                                                               \
+        [241 ... 255] = &&op_nop                                                                                                           \
+    };                                                                                                                                     \
+    struct context_info* execution_context = &org->loe[loe_index];                                                                         \
+    unsigned char instruction = vm_fetch(org, execution_context);                                                                         \
+                                                                                                                                           \
+    TRACE(TRACE_INSTRUCTIONS, org->id, TRACE_INSTRUCTION, instruction, execution_context->i_ptr, execution_context->ptr, 0, 0);            \
+    goto *dispatch[instruction];                                                                                                           \
+                                                                                                                                           \
+op_inc:             return op_inc(org, execution_context, instruction, collisions, shape);                                                 \
+op_dec:             return op_dec(org, execution_context, instruction, collisions, shape);                                                 \
+op_inc_at:          return op_inc_at(org, execution_context, instruction, collisions, shape);                                              \
+op_dec_at:          return op_dec_at(org, execution_context, instruction, collisions, shape);                                              \
+op_right:           return op_right(org, execution_context, instruction, collisions, shape);                                               \
+op_left:            return op_left(org, execution_context, instruction, collisions, shape);                                                \
+op_forward:         return op_forward(org, execution_context, instruction, collisions, shape);                                             \
+op_back:            return op_back(org, execution_context, instruction, collisions, shape);                                                \
+op_while:           return op_while(org, execution_context, instruction, collisions, shape);                                               \
+op_end:             return op_end(org, execution_context, instruction, collisions, shape);                                                 \
+op_detect:          return op_detect(org, execution_context, instruction, collisions, shape);                                              \
+op_bin_detect:      return op_bin_detect(org, execution_context, instruction, collisions, shape);                                          \
+op_ptr_to_reg:      return op_ptr_to_reg(org, execution_context, instruction, collisions, shape);                                          \
+op_reg_to_ptr:      return op_reg_to_ptr(org, execution_context, instruction, collisions, shape);                                          \
+op_jmp:             return op_jmp(org, execution_context, instruction, collisions, shape);                                                 \
+op_grow:            return op_grow(org, execution_context, instruction, collisions, shape);                                                \
+op_bool:            return op_bool(org, execution_context, instruction, collisions, shape);                                                \
+op_detect_obstacle: return op_detect_obstacle(org, execution_context, instruction, collisions, shape);                                     \
+op_load_next:       return op_load_next(org, execution_context, instruction, collisions, shape);                                           \
+op_rand:            return op_rand(org, execution_context, instruction, collisions, shape);                                                \
+op_ptr_from_ip:     return op_ptr_from_ip(org, execution_context, instruction, collisions, shape);                                         \
+op_fire:            return op_fire(org, execution_context, instruction, collisions, shape);                                                \
+op_detect_food:     return op_detect_food(org, execution_context, instruction, collisions, shape);                                         \
+op_store_location:  return op_store_location(org, execution_context, instruction, collisions, shape);                                      \
+op_nop:             return op_nop(org, execution_context, instruction, collisions, shape);                                                 \
+}
+
+/* The generic instance, for any configuration */
+DEFINE_BYTECODE_TICK(bytecode_tick, config_shape())
+
+/* Wraps an LOE's pointers that have left the genome back to its start */
+static inline __attribute__((always_inline)) void context_wrap(struct context_info* execution_context, const struct vm_shape shape) {
+    if(execution_context->ptr >= shape.vm_slots) {
+        execution_context->ptr = 0;
+    }
+    if(execution_context->i_ptr >= shape.vm_slots) {
+        execution_context->i_ptr = 0;
+    }
+}
+
+/* Fixes up VM pointers and returns 0 if organism doesn't have enough food to survive. */
+static inline __attribute__((always_inline)) int organism_checkup(struct organism* org, const struct vm_shape shape) {
+    unsigned int loe_index;
+    for(loe_index = 0; loe_index < shape.num_loe; loe_index++) {
+        context_wrap(&org->loe[loe_index], shape);
+    }
+    return org->food < 0 ? 0 : 1;
+}
+
+/* Handle an organism's collision. Returns 1 if organism is now deleted. */
+int handle_collision(struct organism* org, struct collision_information* info) {
+    if(info->collidedWith == ENVIRONMENT_ORGANISM) { // collided with organism
+        struct organism* other = organism_from_handle(info->org);
+        if(!other || other == org || other->dying) { //died earlier this tick, or never had an owner
+            return 0;
+        }
+        if(organism_size(other) > organism_size(org)) { //organism collided with is bigger
+            org->food += other->food;
+            org->food += organism_size(other) / world->config.org_to_food;
+            organism_delete(other, 1);
+            return 0;
+        } else { //we're bigger
+            other->food += org->food;
+            other->food += organism_size(org) / world->config.org_to_food;
+            organism_delete(org, 2);
+            return 1;
+        }
+    } else if(info->collidedWith == ENVIRONMENT_OBSTACLE) {
+        org->food--;
+        if(org->food <= 0) {
+            organism_delete(org, 3);
+            return 1;
+        }
+    } else if(info->collidedWith == ENVIRONMENT_FOOD) {
+        org->food+=50;
+    }
+    return 0;
+}
+
+/* Bytes to skip before the next mutation site: geometric, capped at vm_slots which is past any site */
+static inline unsigned int mutation_gap(struct rng* r) {
+    const double* survival = world->mutation_survival;
+    double u = (rng_next(r) >> 11) * (1.0 / 9007199254740992.0); //uniform in [0, 1)
+    unsigned int low = 0; //survival[low] > u, survival[high] <= u
+    unsigned int high = world->config.vm_slots;
+    if(survival[high] > u) {
+        return high;
+    }
+    while(high - low > 1) {
+        unsigned int middle = (low + high) / 2;
+        if(survival[middle] > u) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/* Applies one mutation, of a class picked by the configured rates, at byte i of org's genome */
+void organism_mutate(struct organism* org, unsigned int i) {
+    unsigned int vm_slots = world->config.vm_slots;
+    unsigned int pick = rng_below(&org->rng, world->mutation_total);
+    enum mutation m = 0;
+    while(pick >= (unsigned int)world->config.mutation_rates[m]) {
+        pick -= world->config.mutation_rates[m];
+        m++;
+    }
+    unsigned char c = vm_read(org, i);
+    unsigned int j;
+    switch(m) {
+        case MUTATION_DECREMENT:
+            vm_write(org, i, c-1, vm_slots);
+            break;
+        case MUTATION_INCREMENT:
+            vm_write(org, i, c+1, vm_slots);
+            break;
+        case MUTATION_NUDGE:
+            vm_write(org, i, (unsigned char)(c+rng_below(&org->rng, 25)), vm_slots);
+            break;
+        case MUTATION_RANDOM:
+            vm_write(org, i, (unsigned char)rng_next(&org->rng), vm_slots);
+            break;
+        case MUTATION_BIT_FLIP:
+            vm_write(org, i, c ^ (1 << rng_below(&org->rng, 8)), vm_slots);
+            break;
+        case MUTATION_INSERT:
+            genome_insert(org, i, (unsigned char)rng_next(&org->rng));
+            break;
+        case MUTATION_DELETE:
+            genome_delete(org, i, (unsigned char)rng_next(&org->rng));
+            break;
+        default: { //MUTATION_DUPLICATE
+            unsigned char block[MUTATION_BLOCK];
+            unsigned int from = rng_below(&org->rng, vm_slots);
+            unsigned int length = 1 + rng_below(&org->rng, MUTATION_BLOCK);
+            if(length > vm_slots - from) {
+                length = vm_slots - from;
+            }
+            if(length > vm_slots - i) {
+                length = vm_slots - i;
+            }
+            for(j = 0; j < length; j++) { //read it all first, the block may overlap its destination
+                block[j] = vm_read(org, from + j);
+            }
+            for(j = 0; j < length; j++) {
+                vm_write(org, i + j, block[j], vm_slots);
+            }
+            break;
+        }
+    }
+}
+
+/*
+ * Perform intentionally lossy copy of organism's VM. The child starts
+ * out sharing first's genome pages and bracket table, so only the pages a
+ * mutation lands on get copied. Rather than rolling for every byte, the
+ * gaps between mutation sites are drawn directly, so a copy costs random
+ * numbers in proportion to the mutations it makes. Sites are visited in
+ * order in the child's coordinates, so later sites see the shifts earlier
+ * insertions and deletions made.
+ */
+void organism_lossy_copy(struct organism* first, struct organism* second) {
+    genome_share(second, first);
+    if(first->brackets) {
+        atomic_fetch_add_explicit(&first->brackets->refs, 1, memory_order_relaxed);
+    }
+    bracket_table_release(second->brackets);
+    second->brackets = first->brackets;
+    second->brackets_dirty = first->brackets_dirty; //vm_write below marks it if a mutation touches a bracket
+    if(!world->mutation_total) {
+        return;
+    }
+    unsigned int vm_slots = world->config.vm_slots;
+    unsigned int i = mutation_gap(&second->rng);
+    while(i < vm_slots) {
+        organism_mutate(second, i);
+        i += 1 + mutation_gap(&second->rng);
+    }
+}
+
+/* Reproduce and kill organism */
+void organism_reproduce(struct organism* org) {
+    //Artifical reproduction for now
+    //TODO: org->loe[0]->i_ptr = ORG_REPRODUCE;
+    TRACE(TRACE_EVENTS, org->id, TRACE_REPRODUCE, 0, org->food, 0, 0, 0);
+    if(org->food < world->config.org_food) { //organism failed at life, delete & abort
+        organism_delete(org, 4);
+        return;
+    }
+    int offset = org->width + 15;
+    while(org->food > world->config.org_food/2) {
+        struct organism* o = organism_spawn(org);
+        if(!o) { //out of slots, the rest of the food is lost
+            break;
+        }
+        struct location new_location = org->pos;
+        new_location.x += offset;
+        offset += offset;
+        /* Lift the child off the center before moving it, so its old tiles keep no owner */
+        organism_clear_location(o);
+        o->pos = new_location;
+        o->food += world->config.org_food*2;
+        org->food -= world->config.org_food*2;
+        struct collision_information_bundle ignored;
+        organism_write_location(o, &ignored);
+        TRACE(TRACE_EVENTS, o->id, TRACE_BIRTH, 0, org->id, o->pos.x, o->pos.y, 0);
+        if(TRACE_LEVEL >= TRACE_DUMPS && trace_level >= TRACE_DUMPS) {
+            trace_genome(o);
+        }
+    }
+    organism_delete(org, 5);
+}
+
+/*
+ * Runs each organism threads, does checkups (removing if dead), and performs food ticks.
+ * Instantiated once per kernel below with that kernel's shape and threaded interpreter.
+ *
+ * Each LOE normally runs one instruction per tick. With --quantum N it
+ * runs up to N back to back, stopping early after any instruction that
+ * touches the world, so an organism still moves, senses, grows or fires
+ * at most once per LOE per tick and sees the board as of its turn. The
+ * checkups, hunger and lifespan are still once per tick, so organisms
+ * think faster without aging faster. Pointers are wrapped between
+ * instructions, as the checkups do between ticks.
+ */
+static inline __attribute__((always_inline)) void organism_loop_kernel(struct organism* org, const struct vm_shape shape,
+        struct collision_information_bundle* (*tick)(struct organism*, unsigned int, struct collision_information_bundle*)) {
+    /* Pre bytecode checkup, in case affected by another organism */
+    if(!organism_checkup(org, shape)) {
+        organism_delete(org, 6);
+        return;
+    }
+    /* Run each LOE in order */
+    struct collision_information_bundle collision_storage;
+    unsigned int quantum = world->config.quantum;
+    unsigned long long* instructions = &current_region->instructions;
+    unsigned int loe_index;
+    for(loe_index = 0; loe_index < shape.num_loe; loe_index++) {
+        struct context_info* execution_context = &org->loe[loe_index];
+        unsigned int executed = 0;
+        for(;;) {
+            unsigned char instruction = vm_fetch(org, execution_context);
+            METRIC_COUNT(opcodes[instruction]);
+            (*instructions)++;
+            if(is_nop(instruction)) { //nothing to decode or run, so skip the dispatcher and just step
+                TRACE(TRACE_INSTRUCTIONS, org->id, TRACE_INSTRUCTION, instruction, execution_context->i_ptr, execution_context->ptr, 0, 0);
+            } else {
+                struct collision_information_bundle* collision = use_reference_interpreter
+                    ? bytecode_tick_reference(org, loe_index, &collision_storage, shape)
+                    : tick(org, loe_index, &collision_storage);
+                if(collision) { //the organism collided with something!
+                    unsigned int i;
+                    for(i = 0; i < collision->num; i++) {
+                        METRIC_COUNT(collisions[collision->collisions[i].collidedWith]);
+                        if(handle_collision(org, &collision->collisions[i])) {
+                            return;
+                        }
+                    }
+                }
+            }
+            /* Increment organism's instruction pointer */
+            execution_context->i_ptr++;
+            if(++executed >= quantum || touches_world(instruction)) {
+                break;
+            }
+            context_wrap(execution_context, shape);
+        }
+    }
+    /* Increment organism tick */
+    org->ticks_since_birth++;
+    /* Check if needs to be hungry, every config.org_hunger ticks */
+    if(--org->ticks_until_hungry == 0) {
+        /* Get hungry! */
+        org->ticks_until_hungry = world->config.org_hunger;
+        (org->food)--;
+    }
+    /* Check if needs to die and reproduce */
+    if(org->ticks_since_birth > world->config.org_lifespan) {
+        organism_list_push(&current_region->reproducing, org); //children can land anywhere, so wait for the tick to end
+    } else {
         /* Post bytecode checkup, in case organism died while running */
-        if(!organism_checkup(org)) {
-            draw_to_console();
-            organism_print(org);
+        if(!organism_checkup(org, shape)) {
             organism_delete(org, 7);
             return;
         }
     }
-    
-    //debug
-    //organism_print(org);
-    //PAUSE_FROM_STACKOVERFLOW();
+    
+    //debug
+    //organism_print(org);
+    //PAUSE_FROM_STACKOVERFLOW();
+}
+
+/*
+ * Kernels. The presets cover the default configuration and the three-LOE
+ * variant; any other configuration runs the generic kernel, which reads
+ * its shape from config. config_apply picks one.
+ */
+#define SHAPE_DEFAULT ((struct vm_shape){1000, 1, 9})
+#define SHAPE_LOE3    ((struct vm_shape){1000, 3, 9})
+
+DEFINE_BYTECODE_TICK(bytecode_tick_default, SHAPE_DEFAULT)
+DEFINE_BYTECODE_TICK(bytecode_tick_loe3, SHAPE_LOE3)
+
+void organism_loop_default(struct organism* org) {
+    organism_loop_kernel(org, SHAPE_DEFAULT, bytecode_tick_default);
+}
+
+void organism_loop_loe3(struct organism* org) {
+    organism_loop_kernel(org, SHAPE_LOE3, bytecode_tick_loe3);
+}
+
+void organism_loop_generic(struct organism* org) {
+    organism_loop_kernel(org, config_shape(), bytecode_tick);
+}
+
+/* Steps one organism through the selected kernel */
+void organism_loop(struct organism* org) {
+    world->organism_kernel(org);
+}
+
+/* Picks the kernel specialized for the configuration, if there is one */
+void organism_kernel_select() {
+    struct vm_shape shape = config_shape();
+    struct vm_shape presets[] = {SHAPE_DEFAULT, SHAPE_LOE3};
+    void (*kernels[])(struct organism*) = {organism_loop_default, organism_loop_loe3};
+    unsigned int i;
+    world->organism_kernel = organism_loop_generic;
+    for(i = 0; i < sizeof(presets) / sizeof(presets[0]); i++) {
+        if(memcmp(&shape, &presets[i], sizeof(shape)) == 0) {
+            world->organism_kernel = kernels[i];
+        }
+    }
+}
+
+/* One set of metrics, as of the end of a tick */
+struct metrics_snapshot {
+    unsigned long long tick;
+    unsigned long long population;
+    unsigned long long births;
+    unsigned long long deaths;
+    unsigned long long deaths_by_reason[DEATH_REASONS];
+    unsigned long long opcodes[OPCODE_CLASSES];
+    unsigned long long collisions[4];
+    long long food;
+    double mean_size;
+};
+
+enum metrics_format {
+    METRICS_JSONL,
+    METRICS_CSV,
+    METRICS_PROMETHEUS //rewritten whole on every snapshot
+};
+
+const char* const collision_names[4] = {"empty", "organism", "obstacle", "food"};
+
+unsigned long long metrics_every = 1000;
+enum metrics_format metrics_format;
+const char* metrics_path;
+FILE* metrics_file = NULL;
+struct metrics_snapshot metrics_queue[METRICS_QUEUE];
+unsigned int metrics_queued = 0;
+unsigned int metrics_queue_head = 0;
+unsigned long long metrics_dropped = 0; //snapshots lost because the writer fell behind
+unsigned long long metrics_last_tick = -1; //tick of the last snapshot taken
+int metrics_stopping = 0;
+pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t metrics_ready = PTHREAD_COND_INITIALIZER;
+pthread_t metrics_writer;
+
+/* Folds every thread's counters and the organism table into a snapshot. Only call between ticks. */
+void metrics_collect(struct metrics_snapshot* snap) {
+    memset(snap, 0, sizeof(*snap));
+    snap->tick = world->current_tick;
+    snap->births = world->organism_births;
+    snap->deaths = world->organism_deaths;
+    snap->population = world->organism_births - world->organism_deaths;
+    memcpy(snap->deaths_by_reason, world->organism_deaths_by_reason, sizeof(snap->deaths_by_reason));
+    struct metrics_counters* c;
+    unsigned int i;
+    for(c = metrics_threads; c; c = c->next) {
+        for(i = 0; i < 256; i++) {
+            snap->opcodes[opcode_class(i)] += c->opcodes[i];
+        }
+        for(i = 0; i < 4; i++) {
+            snap->collisions[i] += c->collisions[i];
+        }
+    }
+    unsigned long long size = 0;
+    for(i = 0; i < world->num_active; i++) {
+        struct organism* o = world->active[i];
+        snap->food += o->food;
+        size += organism_size(o);
+    }
+    snap->mean_size = snap->population ? (double)size / snap->population : 0;
+}
+
+void metrics_write_jsonl(const struct metrics_snapshot* snap) {
+    unsigned int i;
+    fprintf(metrics_file, "{\"tick\": %llu, \"population\": %llu, \"births\": %llu, \"deaths\": %llu, \"food\": %lld, \"mean_size\": %.3f, \"deaths_by_reason\": {",
+            snap->tick, snap->population, snap->births, snap->deaths, snap->food, snap->mean_size);
+    for(i = 1; i < DEATH_REASONS; i++) {
+        fprintf(metrics_file, "%s\"%u\": %llu", i > 1 ? ", " : "", i, snap->deaths_by_reason[i]);
+    }
+    fprintf(metrics_file, "}, \"collisions\": {");
+    for(i = 1; i < 4; i++) {
+        fprintf(metrics_file, "%s\"%s\": %llu", i > 1 ? ", " : "", collision_names[i], snap->collisions[i]);
+    }
+    fprintf(metrics_file, "}, \"opcodes\": {");
+    for(i = 0; i < OPCODE_CLASSES; i++) {
+        fprintf(metrics_file, "%s\"%s\": %llu", i ? ", " : "", opcode_name(i == 0 ? 0 : i*10 + 1), snap->opcodes[i]);
+    }
+    fprintf(metrics_file, "}}\n");
+}
+
+void metrics_write_csv(const struct metrics_snapshot* snap) {
+    unsigned int i;
+    if(ftell(metrics_file) == 0) { //header
+        fprintf(metrics_file, "tick,population,births,deaths,food,mean_size");
+        for(i = 1; i < DEATH_REASONS; i++) {
+            fprintf(metrics_file, ",deaths_%u", i);
+        }
+        for(i = 1; i < 4; i++) {
+            fprintf(metrics_file, ",collisions_%s", collision_names[i]);
+        }
+        for(i = 0; i < OPCODE_CLASSES; i++) {
+            fprintf(metrics_file, ",\"op %s\"", opcode_name(i == 0 ? 0 : i*10 + 1));
+        }
+        fprintf(metrics_file, "\n");
+    }
+    fprintf(metrics_file, "%llu,%llu,%llu,%llu,%lld,%.3f", snap->tick, snap->population, snap->births, snap->deaths, snap->food, snap->mean_size);
+    for(i = 1; i < DEATH_REASONS; i++) {
+        fprintf(metrics_file, ",%llu", snap->deaths_by_reason[i]);
+    }
+    for(i = 1; i < 4; i++) {
+        fprintf(metrics_file, ",%llu", snap->collisions[i]);
+    }
+    for(i = 0; i < OPCODE_CLASSES; i++) {
+        fprintf(metrics_file, ",%llu", snap->opcodes[i]);
+    }
+    fprintf(metrics_file, "\n");
+}
+
+/* Writes the Prometheus text file next to its final name and renames it over, so scrapers never see half of one */
+void metrics_write_prometheus(const struct metrics_snapshot* snap) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", metrics_path);
+    FILE* out = fopen(tmp, "w");
+    if(!out) {
+        return;
+    }
+    unsigned int i;
+    fprintf(out, "# TYPE cevolution_tick counter\ncevolution_tick %llu\n", snap->tick);
+    fprintf(out, "# TYPE cevolution_population gauge\ncevolution_population %llu\n", snap->population);
+    fprintf(out, "# TYPE cevolution_births_total counter\ncevolution_births_total %llu\n", snap->births);
+    fprintf(out, "# TYPE cevolution_deaths_total counter\n");
+    for(i = 1; i < DEATH_REASONS; i++) {
+        fprintf(out, "cevolution_deaths_total{reason=\"%u\"} %llu\n", i, snap->deaths_by_reason[i]);
+    }
+    fprintf(out, "# TYPE cevolution_food gauge\ncevolution_food %lld\n", snap->food);
+    fprintf(out, "# TYPE cevolution_mean_organism_size gauge\ncevolution_mean_organism_size %.3f\n", snap->mean_size);
+    fprintf(out, "# TYPE cevolution_collisions_total counter\n");
+    for(i = 1; i < 4; i++) {
+        fprintf(out, "cevolution_collisions_total{type=\"%s\"} %llu\n", collision_names[i], snap->collisions[i]);
+    }
+    fprintf(out, "# TYPE cevolution_instructions_total counter\n");
+    for(i = 0; i < OPCODE_CLASSES; i++) {
+        fprintf(out, "cevolution_instructions_total{opcode=\"%s\"} %llu\n", opcode_name(i == 0 ? 0 : i*10 + 1), snap->opcodes[i]);
+    }
+    fclose(out);
+    rename(tmp, metrics_path);
+}
+
+/* Writer thread: formats queued snapshots until stopped and empty */
+void* metrics_writer_main(void* unused) {
+    struct metrics_snapshot snap;
+    pthread_mutex_lock(&metrics_lock);
+    for(;;) {
+        while(metrics_queued == 0 && !metrics_stopping) {
+            pthread_cond_wait(&metrics_ready, &metrics_lock);
+        }
+        if(metrics_queued == 0) {
+            break;
+        }
+        snap = metrics_queue[metrics_queue_head];
+        metrics_queue_head = (metrics_queue_head + 1) % METRICS_QUEUE;
+        metrics_queued--;
+        pthread_mutex_unlock(&metrics_lock);
+        if(metrics_format == METRICS_JSONL) {
+            metrics_write_jsonl(&snap);
+        } else if(metrics_format == METRICS_CSV) {
+            metrics_write_csv(&snap);
+        } else {
+            metrics_write_prometheus(&snap);
+        }
+        if(metrics_file) {
+            fflush(metrics_file);
+        }
+        pthread_mutex_lock(&metrics_lock);
+    }
+    pthread_mutex_unlock(&metrics_lock);
+    return NULL;
+}
+
+/* Hands a snapshot to the writer, dropping it if the writer is that far behind */
+void metrics_publish() {
+    struct metrics_snapshot snap;
+    metrics_collect(&snap);
+    metrics_last_tick = world->current_tick;
+    pthread_mutex_lock(&metrics_lock);
+    if(metrics_queued == METRICS_QUEUE) {
+        metrics_dropped++;
+    } else {
+        metrics_queue[(metrics_queue_head + metrics_queued) % METRICS_QUEUE] = snap;
+        metrics_queued++;
+        pthread_cond_signal(&metrics_ready);
+    }
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/* Called by the main thread after every tick */
+static inline void metrics_tick() {
+    if(METRICS && metrics_enabled && world->current_tick % metrics_every == 0) {
+        metrics_publish();
+    }
+}
+
+/* Opens the sink and starts the writer; the format comes from the extension (.csv, .prom, else JSON lines). Returns 0 on failure. */
+int metrics_start(const char* path, unsigned long long every) {
+    if(!METRICS) {
+        fprintf(stderr, "Metrics are not compiled in (METRICS is 0)\n");
+        return 0;
+    }
+    const char* dot = strrchr(path, '.');
+    metrics_format = dot && strcmp(dot, ".csv") == 0 ? METRICS_CSV
+                   : dot && strcmp(dot, ".prom") == 0 ? METRICS_PROMETHEUS
+                   : METRICS_JSONL;
+    metrics_path = path;
+    if(metrics_format != METRICS_PROMETHEUS) {
+        metrics_file = fopen(path, "w");
+        if(!metrics_file) {
+            perror(path);
+            return 0;
+        }
+    }
+    metrics_every = every ? every : 1;
+    metrics_enabled = 1;
+    metrics_attach();
+    if(pthread_create(&metrics_writer, NULL, metrics_writer_main, NULL) != 0) {
+        metrics_enabled = 0;
+        return 0;
+    }
+    return 1;
+}
+
+/* Writes a last snapshot, waits for the writer to finish and closes the sink */
+void metrics_stop() {
+    if(!metrics_enabled) {
+        return;
+    }
+    if(metrics_last_tick != world->current_tick) {
+        metrics_publish();
+    }
+    pthread_mutex_lock(&metrics_lock);
+    metrics_stopping = 1;
+    pthread_cond_signal(&metrics_ready);
+    pthread_mutex_unlock(&metrics_lock);
+    pthread_join(metrics_writer, NULL);
+    metrics_enabled = 0;
+    if(metrics_file) {
+        fclose(metrics_file);
+        metrics_file = NULL;
+    }
+    if(metrics_dropped) {
+        fprintf(stderr, "Metrics writer fell behind, %llu snapshots dropped\n", metrics_dropped);
+    }
+}
+
+/*
+ * Frame capture. Every --capture-every ticks the main thread boils a
+ * region of the board (--capture-region, the whole board by default) down
+ * to one byte per pixel, each pixel covering --capture-scale tiles
+ * square, and hands it to an encoder thread. Pixels are worked out from
+ * the bit planes one block row word at a time, and blocks that were never
+ * written are not read at all. At most CAPTURE_QUEUE frames wait for the
+ * encoder; when it falls behind, frames are dropped rather than holding
+ * up the tick.
+ *
+ * The encoder appends frames to one file: a header, then per frame its
+ * tick and a run-length encoding of the pixels, XORed with the previous
+ * frame except on every CAPTURE_KEYFRAME-th. Run with --decode-capture
+ * to turn it into a numbered PPM sequence.
+ */
+#define CAPTURE_QUEUE    4  //frames waiting for the encoder
+#define CAPTURE_KEYFRAME 64 //frames between full frames
+#define CAPTURE_MAX_SIDE 1024 //default scale keeps frames within this many pixels a side
+#define CAPTURE_MAGIC    0x43564543 //"CEVC"
+
+/* Pixel values; a pixel covering several kinds of tile shows the highest */
+enum capture_pixel {
+    CAPTURE_EMPTY,
+    CAPTURE_UNTOUCHED, //never written, so still as generated
+    CAPTURE_OBSTACLE,
+    CAPTURE_FOOD,
+    CAPTURE_ORGANISM,
+    CAPTURE_PIXELS
+};
+
+/* Pixel for each bit plane */
+const unsigned char capture_plane_pixels[ENV_PLANES] = {CAPTURE_ORGANISM, CAPTURE_OBSTACLE, CAPTURE_FOOD};
+
+const unsigned char capture_palette[CAPTURE_PIXELS][3] = {
+    {0, 0, 0},       //empty
+    {24, 24, 32},    //untouched
+    {128, 128, 128}, //obstacle
+    {0, 160, 0},     //food
+    {255, 220, 0}    //organism
+};
+
+struct capture_header {
+    unsigned int magic;
+    unsigned int width;  //pixels
+    unsigned int height;
+    unsigned int scale;  //tiles per pixel side
+    unsigned int x;      //tile at the top left pixel
+    unsigned int y;
+};
+
+struct capture_frame {
+    unsigned long long tick;
+    unsigned int bytes;    //of encoded pixels that follow
+    unsigned int keyframe; //else XORed with the previous frame
+};
+
+struct capture_queued {
+    unsigned long long tick;
+    unsigned char* pixels;
+};
+
+int capture_enabled = 0;
+unsigned long long capture_every = 1000;
+struct capture_header capture_shape;
+unsigned int capture_region_width; //in tiles
+unsigned int capture_region_height;
+unsigned int* capture_columns; //pixel column of each tile column in the region
+unsigned int* capture_rows;    //offset of the pixel row of each tile row
+FILE* capture_file = NULL;
+unsigned char* capture_free[CAPTURE_QUEUE + 1]; //pixel buffers not in use
+unsigned int num_capture_free = 0;
+struct capture_queued capture_queue[CAPTURE_QUEUE];
+unsigned int capture_queued = 0;
+unsigned int capture_queue_head = 0;
+unsigned long long capture_dropped = 0;
+unsigned long long capture_last_tick = -1;
+int capture_stopping = 0;
+pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t capture_ready = PTHREAD_COND_INITIALIZER;
+pthread_t capture_encoder;
+
+/* Raises the pixels covering tiles [x0, x1) x [y0, y1) to at least value */
+void capture_raise(unsigned char* pixels, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, unsigned char value) {
+    unsigned int px0 = capture_columns[x0 - capture_shape.x];
+    unsigned int px1 = capture_columns[x1 - 1 - capture_shape.x];
+    unsigned int row0 = capture_rows[y0 - capture_shape.y];
+    unsigned int row1 = capture_rows[y1 - 1 - capture_shape.y];
+    unsigned int offset;
+    for(offset = row0; offset <= row1; offset += capture_shape.width) {
+        unsigned char* row = pixels + offset;
+        unsigned int px;
+        for(px = px0; px <= px1; px++) {
+            if(row[px] < value) {
+                row[px] = value;
+            }
+        }
+    }
+}
+
+/* Draws the captured region into pixels. Only called between ticks, so the board holds still. */
+void capture_fill(unsigned char* pixels) {
+    unsigned int x0 = capture_shape.x;
+    unsigned int y0 = capture_shape.y;
+    unsigned int x1 = x0 + capture_region_width;
+    unsigned int y1 = y0 + capture_region_height;
+    memset(pixels, CAPTURE_EMPTY, capture_shape.width * capture_shape.height);
+    unsigned int bx;
+    unsigned int by;
+    for(by = y0 >> ENV_BLOCK_BITS; by <= (y1 - 1) >> ENV_BLOCK_BITS; by++) {
+        unsigned int ty0 = by << ENV_BLOCK_BITS > y0 ? by << ENV_BLOCK_BITS : y0;
+        unsigned int ty1 = (by + 1) << ENV_BLOCK_BITS < y1 ? (by + 1) << ENV_BLOCK_BITS : y1;
+        for(bx = x0 >> ENV_BLOCK_BITS; bx <= (x1 - 1) >> ENV_BLOCK_BITS; bx++) {
+            unsigned int tx0 = bx << ENV_BLOCK_BITS > x0 ? bx << ENV_BLOCK_BITS : x0;
+            unsigned int tx1 = (bx + 1) << ENV_BLOCK_BITS < x1 ? (bx + 1) << ENV_BLOCK_BITS : x1;
+            struct env_block* b = env_block((by << world->env_directory_shift) | bx);
+            if(!b) {
+                capture_raise(pixels, tx0, ty0, tx1, ty1, CAPTURE_UNTOUCHED);
+                continue;
+            }
+            unsigned int lo = tx0 & ENV_BLOCK_MASK;
+            unsigned int hi = tx1 - (bx << ENV_BLOCK_BITS);
+            unsigned long long mask = (hi == ENV_BLOCK_SIZE ? ~0ULL : (1ULL << hi) - 1) & ~((1ULL << lo) - 1);
+            unsigned int y;
+            for(y = ty0; y < ty1; y++) {
+                unsigned char* row = pixels + capture_rows[y - y0];
+                int plane;
+                for(plane = 0; plane < ENV_PLANES; plane++) {
+                    unsigned long long word = b->rows[plane][y & ENV_BLOCK_MASK] & mask;
+                    unsigned char value = capture_plane_pixels[plane];
+                    while(word) {
+                        unsigned int px = capture_columns[(bx << ENV_BLOCK_BITS) + __builtin_ctzll(word) - x0];
+                        word &= word - 1;
+                        if(row[px] < value) {
+                            row[px] = value;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Appends n as a LEB128 varint, returning the bytes written */
+static inline unsigned int capture_varint(unsigned char* out, unsigned long long n) {
+    unsigned int len = 0;
+    while(n >= 0x80) {
+        out[len++] = (unsigned char)(n | 0x80);
+        n >>= 7;
+    }
+    out[len++] = (unsigned char)n;
+    return len;
+}
+
+/* Run-length encodes pixels (XORed with previous unless NULL) as (run length, value) pairs. out needs 2 bytes a pixel at worst. */
+unsigned int capture_encode(const unsigned char* pixels, const unsigned char* previous, unsigned int n, unsigned char* out) {
+    unsigned int len = 0;
+    unsigned int i = 0;
+    while(i < n) {
+        unsigned char value = previous ? pixels[i] ^ previous[i] : pixels[i];
+        unsigned int run = 1;
+        while(i + run < n && (previous ? pixels[i+run] ^ previous[i+run] : pixels[i+run]) == value) {
+            run++;
+        }
+        len += capture_varint(out + len, run);
+        out[len++] = value;
+        i += run;
+    }
+    return len;
+}
+
+void* capture_encoder_main(void* unused) {
+    unsigned int n = capture_shape.width * capture_shape.height;
+    unsigned char* encoded = malloc(2 * (size_t)n);
+    unsigned char* previous = NULL;
+    unsigned long long frames = 0;
+    pthread_mutex_lock(&capture_lock);
+    for(;;) {
+        while(capture_queued == 0 && !capture_stopping) {
+            pthread_cond_wait(&capture_ready, &capture_lock);
+        }
+        if(capture_queued == 0) {
+            break;
+        }
+        struct capture_queued frame = capture_queue[capture_queue_head];
+        capture_queue_head = (capture_queue_head + 1) % CAPTURE_QUEUE;
+        capture_queued--;
+        pthread_mutex_unlock(&capture_lock);
+
+        struct capture_frame record;
+        record.tick = frame.tick;
+        record.keyframe = !previous || frames % CAPTURE_KEYFRAME == 0;
+        record.bytes = capture_encode(frame.pixels, record.keyframe ? NULL : previous, n, encoded);
+        fwrite(&record, sizeof(record), 1, capture_file);
+        fwrite(encoded, 1, record.bytes, capture_file);
+        fflush(capture_file);
+        frames++;
+
+        /* Keep this frame to diff the next one against, and give the one before back */
+        pthread_mutex_lock(&capture_lock);
+        if(previous) {
+            capture_free[num_capture_free++] = previous;
+        }
+        previous = frame.pixels;
+    }
+    if(previous) {
+        capture_free[num_capture_free++] = previous;
+    }
+    pthread_mutex_unlock(&capture_lock);
+    free(encoded);
+    return NULL;
+}
+
+/* Captures the current tick, unless the encoder is too far behind */
+void capture_publish() {
+    capture_last_tick = world->current_tick;
+    pthread_mutex_lock(&capture_lock);
+    unsigned char* pixels = num_capture_free && capture_queued < CAPTURE_QUEUE ? capture_free[--num_capture_free] : NULL;
+    pthread_mutex_unlock(&capture_lock);
+    if(!pixels) {
+        capture_dropped++;
+        return;
+    }
+    capture_fill(pixels);
+    pthread_mutex_lock(&capture_lock);
+    capture_queue[(capture_queue_head + capture_queued) % CAPTURE_QUEUE].tick = world->current_tick;
+    capture_queue[(capture_queue_head + capture_queued) % CAPTURE_QUEUE].pixels = pixels;
+    capture_queued++;
+    pthread_cond_signal(&capture_ready);
+    pthread_mutex_unlock(&capture_lock);
+}
+
+/* Called by the main thread after every tick */
+static inline void capture_tick() {
+    if(capture_enabled && world->current_tick % capture_every == 0) {
+        capture_publish();
+    }
+}
+
+/*
+ * Opens the capture file and starts the encoder. The region is x, y, width,
+ * height in tiles, width 0 for the whole board; scale 0 picks the smallest
+ * that fits CAPTURE_MAX_SIDE. Returns 0 on failure.
+ */
+int capture_start(const char* path, unsigned long long every, int x, int y, int width, int height, unsigned int scale) {
+    if(width <= 0 || height <= 0) {
+        x = 0;
+        y = 0;
+        width = world->config.board_width;
+        height = world->config.board_height;
+    }
+    if(x < 0 || y < 0 || x >= world->config.board_width || y >= world->config.board_height) {
+        fprintf(stderr, "Capture region starts off the board\n");
+        return 0;
+    }
+    if(width > world->config.board_width - x) {
+        width = world->config.board_width - x;
+    }
+    if(height > world->config.board_height - y) {
+        height = world->config.board_height - y;
+    }
+    if(scale == 0) {
+        int side = width > height ? width : height;
+        scale = (side + CAPTURE_MAX_SIDE - 1) / CAPTURE_MAX_SIDE;
+    }
+    capture_shape.magic = CAPTURE_MAGIC;
+    capture_shape.width = (width + scale - 1) / scale;
+    capture_shape.height = (height + scale - 1) / scale;
+    capture_shape.scale = scale;
+    capture_shape.x = x;
+    capture_shape.y = y;
+    capture_region_width = width;
+    capture_region_height = height;
+    capture_columns = malloc(sizeof(unsigned int) * width);
+    capture_rows = malloc(sizeof(unsigned int) * height);
+    int i;
+    for(i = 0; i < width; i++) {
+        capture_columns[i] = i / scale;
+    }
+    for(i = 0; i < height; i++) {
+        capture_rows[i] = i / scale * capture_shape.width;
+    }
+    capture_file = fopen(path, "wb");
+    if(!capture_file) {
+        perror(path);
+        return 0;
+    }
+    fwrite(&capture_shape, sizeof(capture_shape), 1, capture_file);
+    for(num_capture_free = 0; num_capture_free < CAPTURE_QUEUE + 1; num_capture_free++) {
+        capture_free[num_capture_free] = malloc(capture_shape.width * capture_shape.height);
+    }
+    capture_every = every ? every : 1;
+    if(pthread_create(&capture_encoder, NULL, capture_encoder_main, NULL) != 0) {
+        perror("pthread_create");
+        return 0;
+    }
+    capture_enabled = 1;
+    return 1;
+}
+
+/* Captures a last frame, waits for the encoder to finish and closes the file */
+void capture_stop() {
+    if(!capture_enabled) {
+        return;
+    }
+    if(capture_last_tick != world->current_tick) {
+        capture_publish();
+    }
+    pthread_mutex_lock(&capture_lock);
+    capture_stopping = 1;
+    pthread_cond_signal(&capture_ready);
+    pthread_mutex_unlock(&capture_lock);
+    pthread_join(capture_encoder, NULL);
+    capture_enabled = 0;
+    fclose(capture_file);
+    capture_file = NULL;
+    while(num_capture_free > 0) {
+        free(capture_free[--num_capture_free]);
+    }
+    free(capture_columns);
+    free(capture_rows);
+    if(capture_dropped) {
+        fprintf(stderr, "Capture encoder fell behind, %llu frames dropped\n", capture_dropped);
+    }
+}
+
+/* Writes every frame of a capture file as PATH.NNNNNN.ppm */
+int capture_decode(const char* path) {
+    FILE* in = fopen(path, "rb");
+    if(!in) {
+        perror(path);
+        return 1;
+    }
+    struct capture_header header;
+    if(fread(&header, sizeof(header), 1, in) != 1 || header.magic != CAPTURE_MAGIC || !header.width || !header.height) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        fclose(in);
+        return 1;
+    }
+    unsigned int n = header.width * header.height;
+    unsigned char* pixels = calloc(n, 1);
+    unsigned char* encoded = malloc(2 * (size_t)n);
+    unsigned char* rgb = malloc(3 * (size_t)n);
+    size_t name_len = strlen(path) + 16;
+    char* name = malloc(name_len);
+    struct capture_frame record;
+    unsigned int frames = 0;
+    int status = 0;
+    while(fread(&record, sizeof(record), 1, in) == 1) {
+        if(record.bytes > 2 * (size_t)n || fread(encoded, 1, record.bytes, in) != record.bytes) {
+            fprintf(stderr, "%s: frame %u is truncated\n", path, frames);
+            status = 1;
+            break;
+        }
+        unsigned int i = 0;
+        unsigned int pos = 0;
+        while(pos < record.bytes && i < n) {
+            unsigned long long run = 0;
+            int shift = 0;
+            while(pos < record.bytes && encoded[pos] & 0x80 && shift < 56) {
+                run |= (unsigned long long)(encoded[pos++] & 0x7F) << shift;
+                shift += 7;
+            }
+            if(pos + 1 >= record.bytes) { //no room for the last length byte and the value
+                break;
+            }
+            run |= (unsigned long long)encoded[pos++] << shift;
+            unsigned char value = encoded[pos++];
+            for(; run > 0 && i < n; run--, i++) {
+                pixels[i] = record.keyframe ? value : pixels[i] ^ value;
+            }
+        }
+        for(i = 0; i < n; i++) {
+            const unsigned char* color = capture_palette[pixels[i] < CAPTURE_PIXELS ? pixels[i] : 0];
+            rgb[3*i]   = color[0];
+            rgb[3*i+1] = color[1];
+            rgb[3*i+2] = color[2];
+        }
+        snprintf(name, name_len, "%s.%06u.ppm", path, frames);
+        FILE* out = fopen(name, "wb");
+        if(!out) {
+            perror(name);
+            status = 1;
+            break;
+        }
+        fprintf(out, "P6\n# tick %llu\n%u %u\n255\n", record.tick, header.width, header.height);
+        fwrite(rgb, 3, n, out);
+        fclose(out);
+        frames++;
+    }
+    printf("%u frames of %ux%u (%u tiles a pixel, from %u,%u)\n", frames, header.width, header.height, header.scale, header.x, header.y);
+    free(name);
+    free(rgb);
+    free(encoded);
+    free(pixels);
+    fclose(in);
+    return status;
+}
+
+/*
+ * Lineage archive (--lineage PATH). Every birth and death is recorded
+ * with the organism's serial (its birth number, which unlike its id is
+ * never reused), its parent's serial, the tick and the death reason, and
+ * the genome every organism is born with goes into the same append-only
+ * file.
+ *
+ * A genome is named by a hash that sums a mix of each byte with its
+ * offset, so changing a few bytes updates it in a few steps, and each
+ * hash is stored once. Genomes are stored as the bytes that differ from
+ * an earlier one, normally the parent's as it was when the child was
+ * born, and only random and heavily rewritten genomes are stored whole.
+ * To diff cheaply every organism keeps a second page table holding the
+ * genome it was last archived with: pages still shared with it are
+ * unchanged, so only the others are compared.
+ *
+ * Records go out LINEAGE_BATCH bytes at a time through a writer thread.
+ * Nothing is dropped; with LINEAGE_QUEUE batches waiting the simulation
+ * waits too. --lineage-tree and --lineage-genome read the file back.
+ */
+#define LINEAGE_BATCH 65536 //bytes handed to the writer at once
+#define LINEAGE_QUEUE 8     //batches waiting for the writer
+#define LINEAGE_MAGIC 0x4C564543 //"CEVL"
+#define LINEAGE_NONE  (~0ULL) //parent serial of organisms that had none
+
+enum lineage_record_type {
+    LINEAGE_BIRTH, //a serial, b parent serial, c tick, d genome hash
+    LINEAGE_DEATH, //a serial, c tick, count reason
+    LINEAGE_FULL,  //a genome hash; followed by the count bytes of the genome
+    LINEAGE_DELTA  //a genome hash, b hash of the genome it is based on; followed by count changes
+};
+
+struct lineage_header {
+    unsigned int magic;
+    unsigned int vm_slots;
+    unsigned long long seed;
+};
+
+struct lineage_record {
+    unsigned int type;
+    unsigned int count;
+    unsigned long long a;
+    unsigned long long b;
+    unsigned long long c;
+    unsigned long long d;
+};
+
+#define LINEAGE_CHANGE_BYTES 3 //a change is the offset, low byte first, then the new value
+
+FILE* lineage_file = NULL;
+unsigned char* lineage_batch;       //records not yet handed to the writer
+size_t lineage_batch_used = 0;
+unsigned char* lineage_scratch;     //payload being built, 3 bytes per genome byte
+unsigned long long* lineage_hashes; //every genome hash archived so far, 0 for an empty slot
+size_t lineage_hashes_size = 0;     //a power of two
+size_t lineage_num_hashes = 0;
+int lineage_zero_seen = 0;          //whether the genome hashing to 0 was archived
+unsigned char* lineage_queue[LINEAGE_QUEUE];
+size_t lineage_queue_bytes[LINEAGE_QUEUE];
+unsigned int lineage_queued = 0;
+unsigned int lineage_queue_head = 0;
+int lineage_stopping = 0;
+pthread_mutex_t lineage_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t lineage_ready = PTHREAD_COND_INITIALIZER; //a batch is waiting
+pthread_cond_t lineage_space = PTHREAD_COND_INITIALIZER; //a batch was written
+pthread_t lineage_writer;
+
+/* Contribution of one genome byte to its genome's hash */
+static inline unsigned long long lineage_byte_hash(unsigned int offset, unsigned char value) {
+    unsigned long long x = ((unsigned long long)offset << 8) | value;
+    return splitmix64(&x);
+}
+
+/* Hash of an organism's whole genome */
+unsigned long long lineage_genome_hash(struct organism* o) {
+    unsigned long long hash = 0;
+    unsigned int i;
+    for(i = 0; i < world->config.vm_slots; i++) {
+        hash += lineage_byte_hash(i, vm_read(o, i));
+    }
+    return hash;
+}
+
+/* Returns whether a genome hash was archived already, and marks it archived */
+int lineage_seen(unsigned long long hash) {
+    if(hash == 0) {
+        int seen = lineage_zero_seen;
+        lineage_zero_seen = 1;
+        return seen;
+    }
+    if(2 * (lineage_num_hashes + 1) > lineage_hashes_size) { //keep it at most half full
+        size_t old_size = lineage_hashes_size;
+        unsigned long long* old = lineage_hashes;
+        lineage_hashes_size = old_size ? old_size * 2 : 4096;
+        lineage_hashes = calloc(lineage_hashes_size, sizeof(unsigned long long));
+        size_t i;
+        for(i = 0; i < old_size; i++) {
+            if(old[i]) {
+                size_t slot = old[i] & (lineage_hashes_size - 1);
+                while(lineage_hashes[slot]) {
+                    slot = (slot + 1) & (lineage_hashes_size - 1);
+                }
+                lineage_hashes[slot] = old[i];
+            }
+        }
+        free(old);
+    }
+    size_t slot = hash & (lineage_hashes_size - 1);
+    while(lineage_hashes[slot]) {
+        if(lineage_hashes[slot] == hash) {
+            return 1;
+        }
+        slot = (slot + 1) & (lineage_hashes_size - 1);
+    }
+    lineage_hashes[slot] = hash;
+    lineage_num_hashes++;
+    return 0;
+}
+
+/* Hands the batch to the writer, waiting if it is LINEAGE_QUEUE batches behind */
+void lineage_flush() {
+    if(!lineage_batch_used) {
+        return;
+    }
+    pthread_mutex_lock(&lineage_lock);
+    while(lineage_queued == LINEAGE_QUEUE) {
+        pthread_cond_wait(&lineage_space, &lineage_lock);
+    }
+    unsigned int slot = (lineage_queue_head + lineage_queued) % LINEAGE_QUEUE;
+    lineage_queue[slot] = lineage_batch;
+    lineage_queue_bytes[slot] = lineage_batch_used;
+    lineage_queued++;
+    pthread_cond_signal(&lineage_ready);
+    pthread_mutex_unlock(&lineage_lock);
+    lineage_batch = malloc(LINEAGE_BATCH + sizeof(struct lineage_record) + LINEAGE_CHANGE_BYTES * world->config.vm_slots);
+    lineage_batch_used = 0;
+}
+
+/* Appends a record and its payload to the batch */
+void lineage_emit(struct lineage_record* record, const unsigned char* payload, size_t bytes) {
+    memcpy(lineage_batch + lineage_batch_used, record, sizeof(struct lineage_record));
+    if(bytes) { //births and deaths carry no payload
+        memcpy(lineage_batch + lineage_batch_used + sizeof(struct lineage_record), payload, bytes);
+    }
+    lineage_batch_used += sizeof(struct lineage_record) + bytes;
+    if(lineage_batch_used >= LINEAGE_BATCH) {
+        lineage_flush();
+    }
+}
+
+/* Writer thread: writes batches in order until stopped and empty */
+void* lineage_writer_main(void* unused) {
+    pthread_mutex_lock(&lineage_lock);
+    for(;;) {
+        while(lineage_queued == 0 && !lineage_stopping) {
+            pthread_cond_wait(&lineage_ready, &lineage_lock);
+        }
+        if(lineage_queued == 0) {
+            break;
+        }
+        unsigned char* batch = lineage_queue[lineage_queue_head];
+        size_t bytes = lineage_queue_bytes[lineage_queue_head];
+        pthread_mutex_unlock(&lineage_lock);
+        fwrite(batch, 1, bytes, lineage_file);
+        free(batch);
+        pthread_mutex_lock(&lineage_lock);
+        lineage_queue_head = (lineage_queue_head + 1) % LINEAGE_QUEUE;
+        lineage_queued--;
+        pthread_cond_signal(&lineage_space);
+    }
+    pthread_mutex_unlock(&lineage_lock);
+    return NULL;
+}
+
+/*
+ * Archives an organism's genome if it changed since its last record, as
+ * the bytes that differ from that record or whole if most of them do.
+ * Returns the genome's hash.
+ */
+unsigned long long lineage_sync(struct organism* o) {
+    unsigned long long hash = o->archived_hash;
+    unsigned int count = 0;
+    unsigned int p;
+    for(p = 0; p < world->genome_num_pages; p++) {
+        const struct genome_page* now = o->genome[p];
+        const struct genome_page* then = o->archived[p];
+        if(now == then) { //still shared, so nothing was written to it
+            continue;
+        }
+        unsigned int i;
+        for(i = 0; i < GENOME_PAGE_SIZE && (p << GENOME_PAGE_BITS) + i < world->config.vm_slots; i++) {
+            if(now->bytes[i] != then->bytes[i]) {
+                unsigned int offset = (p << GENOME_PAGE_BITS) + i;
+                hash += lineage_byte_hash(offset, now->bytes[i]) - lineage_byte_hash(offset, then->bytes[i]);
+                lineage_scratch[LINEAGE_CHANGE_BYTES * count]     = offset & 0xFF;
+                lineage_scratch[LINEAGE_CHANGE_BYTES * count + 1] = offset >> 8;
+                lineage_scratch[LINEAGE_CHANGE_BYTES * count + 2] = now->bytes[i];
+                count++;
+            }
+        }
+    }
+    if(count && !lineage_seen(hash)) {
+        struct lineage_record record = {LINEAGE_DELTA, count, hash, o->archived_hash, 0, 0};
+        if(LINEAGE_CHANGE_BYTES * count >= world->config.vm_slots) { //cheaper whole
+            record.type = LINEAGE_FULL;
+            record.count = world->config.vm_slots;
+            record.b = 0;
+            genome_copy_out(o, lineage_scratch);
+        }
+        lineage_emit(&record, lineage_scratch, record.type == LINEAGE_FULL ? record.count : LINEAGE_CHANGE_BYTES * count);
+    }
+    genome_table_share(o->archived, o->genome);
+    o->archived_hash = hash;
+    return hash;
+}
+
+/* Records a birth, archiving the parent's genome as it is now and the child's against it */
+void lineage_birth(struct organism* o, struct organism* parent) {
+    unsigned long long hash;
+    if(parent) {
+        lineage_sync(parent);
+        genome_table_share(o->archived, parent->archived);
+        o->archived_hash = parent->archived_hash;
+        hash = lineage_sync(o);
+    } else {
+        hash = lineage_genome_hash(o);
+        if(!lineage_seen(hash)) {
+            struct lineage_record record = {LINEAGE_FULL, world->config.vm_slots, hash, 0, 0, 0};
+            genome_copy_out(o, lineage_scratch);
+            lineage_emit(&record, lineage_scratch, world->config.vm_slots);
+        }
+        genome_table_share(o->archived, o->genome);
+        o->archived_hash = hash;
+    }
+    struct lineage_record record = {LINEAGE_BIRTH, 0, o->serial, parent ? parent->serial : LINEAGE_NONE, world->current_tick, hash};
+    lineage_emit(&record, NULL, 0);
+}
+
+/* Records a death and lets go of the archived genome */
+void lineage_death(struct organism* o, int reason) {
+    struct lineage_record record = {LINEAGE_DEATH, reason, o->serial, 0, world->current_tick, 0};
+    lineage_emit(&record, NULL, 0);
+    genome_table_release(o->archived);
+}
+
+/* Opens the lineage file and starts the writer. lineage_enabled must have been set before config_apply. Returns 0 on failure. */
+int lineage_start(const char* path) {
+    lineage_file = fopen(path, "wb");
+    if(!lineage_file) {
+        perror(path);
+        return 0;
+    }
+    struct lineage_header header = {LINEAGE_MAGIC, world->config.vm_slots, world->seed};
+    fwrite(&header, sizeof(header), 1, lineage_file);
+    lineage_batch = malloc(LINEAGE_BATCH + sizeof(struct lineage_record) + LINEAGE_CHANGE_BYTES * world->config.vm_slots);
+    lineage_scratch = malloc(LINEAGE_CHANGE_BYTES * world->config.vm_slots);
+    if(pthread_create(&lineage_writer, NULL, lineage_writer_main, NULL) != 0) {
+        perror("pthread_create");
+        return 0;
+    }
+    return 1;
+}
+
+/* Writes what is left, waits for the writer and closes the file */
+void lineage_stop() {
+    if(!lineage_file) {
+        return;
+    }
+    lineage_flush();
+    pthread_mutex_lock(&lineage_lock);
+    lineage_stopping = 1;
+    pthread_cond_signal(&lineage_ready);
+    pthread_mutex_unlock(&lineage_lock);
+    pthread_join(lineage_writer, NULL);
+    fclose(lineage_file);
+    lineage_file = NULL;
+    free(lineage_batch);
+    free(lineage_scratch);
+    free(lineage_hashes);
+}
+
+/* What a lineage file says about one organism, indexed by serial */
+struct lineage_entry {
+    unsigned long long parent;
+    unsigned long long born;
+    unsigned long long died;
+    unsigned long long genome;
+    int reason; //0 while alive
+};
+
+/* Where a lineage file keeps one genome */
+struct lineage_genome {
+    unsigned long long hash;
+    unsigned long long base;
+    long offset; //of the payload
+    unsigned int type;
+    unsigned int count;
+};
+
+/* A lineage file read into an index */
+struct lineage_index {
+    struct lineage_header header;
+    struct lineage_entry* entries;
+    unsigned long long num_entries;
+    struct lineage_genome* genomes; //open addressing on hash, count 0 for an empty slot
+    size_t genomes_size;
+    int damaged; //the tail could not be read
+};
+
+/* Finds a genome in the index, or NULL */
+struct lineage_genome* lineage_index_find(struct lineage_index* index, unsigned long long hash) {
+    size_t slot = hash & (index->genomes_size - 1);
+    while(index->genomes[slot].count) {
+        if(index->genomes[slot].hash == hash) {
+            return &index->genomes[slot];
+        }
+        slot = (slot + 1) & (index->genomes_size - 1);
+    }
+    return NULL;
+}
+
+/* Reads a lineage file into an index. Returns 0 if it is not one; a truncated or damaged tail is reported and skipped. */
+int lineage_index_load(FILE* in, const char* path, struct lineage_index* index) {
+    memset(index, 0, sizeof(*index));
+    if(fread(&index->header, sizeof(index->header), 1, in) != 1 || index->header.magic != LINEAGE_MAGIC) {
+        fprintf(stderr, "%s: not a lineage file\n", path);
+        return 0;
+    }
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, sizeof(index->header), SEEK_SET);
+    long end = sizeof(index->header); //of the last whole record
+    size_t entries_size = 0;
+    size_t num_genomes = 0;
+    struct lineage_record record;
+    while(fread(&record, sizeof(record), 1, in) == 1) {
+        if(record.type == LINEAGE_BIRTH || record.type == LINEAGE_DEATH) {
+            if(record.a >= entries_size) {
+                size_t old_size = entries_size;
+                entries_size = record.a >= 2 * entries_size ? record.a + 1024 : 2 * entries_size;
+                index->entries = realloc(index->entries, sizeof(struct lineage_entry) * entries_size);
+                memset(index->entries + old_size, 0, sizeof(struct lineage_entry) * (entries_size - old_size));
+            }
+            struct lineage_entry* entry = &index->entries[record.a];
+            if(record.type == LINEAGE_BIRTH) {
+                entry->parent = record.b;
+                entry->born = record.c;
+                entry->genome = record.d;
+                if(record.a >= index->num_entries) {
+                    index->num_entries = record.a + 1;
+                }
+            } else {
+                entry->died = record.c;
+                entry->reason = record.count;
+            }
+            end = ftell(in);
+            continue;
+        }
+        if(record.type != LINEAGE_FULL && record.type != LINEAGE_DELTA) {
+            break;
+        }
+        long payload = ftell(in);
+        long bytes = record.type == LINEAGE_FULL ? record.count : (long)LINEAGE_CHANGE_BYTES * record.count;
+        if(!record.count || payload + bytes > size) {
+            break;
+        }
+        fseek(in, bytes, SEEK_CUR);
+        end = payload + bytes;
+        if(2 * (num_genomes + 1) > index->genomes_size) {
+            size_t old_size = index->genomes_size;
+            struct lineage_genome* old = index->genomes;
+            index->genomes_size = old_size ? old_size * 2 : 4096;
+            index->genomes = calloc(index->genomes_size, sizeof(struct lineage_genome));
+            size_t i;
+            for(i = 0; i < old_size; i++) {
+                if(old[i].count) {
+                    size_t slot = old[i].hash & (index->genomes_size - 1);
+                    while(index->genomes[slot].count) {
+                        slot = (slot + 1) & (index->genomes_size - 1);
+                    }
+                    index->genomes[slot] = old[i];
+                }
+            }
+            free(old);
+        }
+        size_t slot = record.a & (index->genomes_size - 1);
+        while(index->genomes[slot].count && index->genomes[slot].hash != record.a) {
+            slot = (slot + 1) & (index->genomes_size - 1);
+        }
+        if(!index->genomes[slot].count) {
+            num_genomes++;
+        }
+        index->genomes[slot].hash = record.a;
+        index->genomes[slot].base = record.b;
+        index->genomes[slot].offset = payload;
+        index->genomes[slot].type = record.type;
+        index->genomes[slot].count = record.count;
+    }
+    if(end != size) {
+        fprintf(stderr, "%s: unreadable after byte %ld, ignoring the rest\n", path, end);
+        index->damaged = 1;
+    }
+    if(!index->genomes) { //so lookups always have a table to probe
+        index->genomes_size = 1;
+        index->genomes = calloc(1, sizeof(struct lineage_genome));
+    }
+    return 1;
+}
+
+/* Rebuilds a genome from the index into bytes (header.vm_slots long). Returns 0 if a link of its chain is missing. */
+int lineage_index_genome(FILE* in, struct lineage_index* index, unsigned long long hash, unsigned char* bytes) {
+    /* Walk back to a whole genome, then apply the deltas forwards */
+    size_t length = 0;
+    size_t capacity = 64;
+    struct lineage_genome** chain = malloc(sizeof(struct lineage_genome*) * capacity);
+    struct lineage_genome* g = lineage_index_find(index, hash);
+    while(g && g->type == LINEAGE_DELTA && length <= index->genomes_size) {
+        if(length == capacity) {
+            capacity *= 2;
+            chain = realloc(chain, sizeof(struct lineage_genome*) * capacity);
+        }
+        chain[length++] = g;
+        g = lineage_index_find(index, g->base);
+    }
+    int found = g && g->type == LINEAGE_FULL && g->count == index->header.vm_slots;
+    if(found) {
+        fseek(in, g->offset, SEEK_SET);
+        found = fread(bytes, 1, g->count, in) == g->count;
+    }
+    unsigned char change[LINEAGE_CHANGE_BYTES];
+    while(found && length > 0) {
+        g = chain[--length];
+        fseek(in, g->offset, SEEK_SET);
+        unsigned int i;
+        for(i = 0; i < g->count && found; i++) {
+            found = fread(change, LINEAGE_CHANGE_BYTES, 1, in) == 1;
+            unsigned int offset = change[0] | (change[1] << 8);
+            if(found && offset < index->header.vm_slots) {
+                bytes[offset] = change[2];
+            }
+        }
+    }
+    free(chain);
+    return found;
+}
+
+void lineage_index_free(struct lineage_index* index) {
+    free(index->entries);
+    free(index->genomes);
+}
+
+/* Prints every organism of a lineage file as a JSON line, in birth order */
+int lineage_tree(const char* path) {
+    FILE* in = fopen(path, "rb");
+    if(!in) {
+        perror(path);
+        return 1;
+    }
+    struct lineage_index index;
+    if(!lineage_index_load(in, path, &index)) {
+        fclose(in);
+        return 1;
+    }
+    unsigned long long serial;
+    for(serial = 0; serial < index.num_entries; serial++) {
+        struct lineage_entry* entry = &index.entries[serial];
+        printf("{\"serial\": %llu, \"parent\": ", serial);
+        if(entry->parent == LINEAGE_NONE) {
+            printf("null");
+        } else {
+            printf("%llu", entry->parent);
+        }
+        printf(", \"born\": %llu, ", entry->born);
+        if(entry->reason) {
+            printf("\"died\": %llu, \"reason\": %d", entry->died, entry->reason);
+        } else {
+            printf("\"died\": null, \"reason\": null");
+        }
+        printf(", \"genome\": \"%016llx\"}\n", entry->genome);
+    }
+    int status = index.damaged;
+    lineage_index_free(&index);
+    fclose(in);
+    return status;
+}
+
+/* Prints the genome an organism was born with as a JSON line, bytes in hex */
+int lineage_genome(const char* path, unsigned long long serial) {
+    FILE* in = fopen(path, "rb");
+    if(!in) {
+        perror(path);
+        return 1;
+    }
+    struct lineage_index index;
+    if(!lineage_index_load(in, path, &index)) {
+        fclose(in);
+        return 1;
+    }
+    int status = 1;
+    unsigned char* bytes = malloc(index.header.vm_slots);
+    if(serial >= index.num_entries) {
+        fprintf(stderr, "%s: no organism %llu\n", path, serial);
+    } else if(!lineage_index_genome(in, &index, index.entries[serial].genome, bytes)) {
+        fprintf(stderr, "%s: genome %016llx of organism %llu is incomplete\n", path, index.entries[serial].genome, serial);
+    } else {
+        printf("{\"serial\": %llu, \"hash\": \"%016llx\", \"genome\": \"", serial, index.entries[serial].genome);
+        unsigned int i;
+        for(i = 0; i < index.header.vm_slots; i++) {
+            printf("%02x", bytes[i]);
+        }
+        printf("\"}\n");
+        status = 0;
+    }
+    free(bytes);
+    lineage_index_free(&index);
+    fclose(in);
+    return status;
+}
+
+/*
+ * Tick engine.
+ *
+ * The board is cut into vertical strips world->strip_width tiles wide and
+ * every organism is stepped by the strip its left edge is in. In one tick
+ * an organism can only affect tiles within ORGANISM_REACH of its
+ * footprint (moving, growing, sensing or firing), and its footprint may
+ * not be wider than STRIP_MAX_FOOTPRINT. Strips are run checkerboard
+ * style: all even strips, then all odd ones. Two even (or two odd) strips
+ * are then a whole strip apart, which is far enough that they can't touch
+ * the same tile or the same neighbouring organism, so with --threads N
+ * they run in parallel.
+ *
+ * Within a strip organisms are stepped in active list order, and deaths
+ * and births are carried out serially in strip order at the end of the
+ * tick. Since strips of the same parity can't affect each other, it makes
+ * no difference which thread steps which or when, and a seed produces the
+ * same run for any --threads, 0 included: then the calling thread steps
+ * every strip itself. A tick in which some organism is too wide for this
+ * also runs its strips on the calling thread, in order. determinism.sh
+ * checks this with the bench's state_hash.
+ */
+#define ORGANISM_REACH      (world->config.search_dist + 2*world->config.num_loe + 2)
+#define STRIP_MAX_FOOTPRINT ((world->strip_width - 2*ORGANISM_REACH) / 2)
+#define STRIP_MIN_FOOTPRINT (STRIP_WIDTH / 4) //organisms are allowed at least this wide, however far they reach
+
+struct world* tick_world; //the world the threads were started on
+unsigned int* region_tasks;
+unsigned int num_region_tasks;
+atomic_uint next_region_task;
+pthread_barrier_t tick_barrier;
+pthread_t* tick_workers;
+int tick_workers_exit = 0;
+
+/*
+ * Cuts the board into strips. They are STRIP_WIDTH tiles wide unless
+ * config.search_dist reaches so far that organisms of STRIP_MIN_FOOTPRINT
+ * would not fit, in which case they are made wider (and fewer).
+ */
+int strips_init() {
+    world->strip_width = STRIP_WIDTH;
+    while(STRIP_MAX_FOOTPRINT < STRIP_MIN_FOOTPRINT) {
+        world->strip_width *= 2;
+    }
+    world->num_strips = (world->config.board_width + world->strip_width - 1) / world->strip_width;
+    world->regions = calloc(world->num_strips, sizeof(struct tick_region));
+    return world->regions != NULL;
+}
+
+/* Steps the organisms of one strip */
+void run_region(struct tick_region* region) {
+    current_region = region;
+    unsigned int i;
+    for(i = 0; i < region->members.num; i++) {
+        if(!region->members.items[i]->dying) {
+            organism_loop(region->members.items[i]);
+        }
+    }
+    current_region = NULL;
+}
+
+/* Steps strips until none of this phase are left */
+void run_region_tasks() {
+    for(;;) {
+        unsigned int task = atomic_fetch_add(&next_region_task, 1);
+        if(task >= num_region_tasks) {
+            break;
+        }
+        run_region(&world->regions[region_tasks[task]]);
+    }
+}
+
+void* tick_worker_main(void* unused) {
+    world = tick_world;
+    metrics_attach();
+    for(;;) {
+        pthread_barrier_wait(&tick_barrier);
+        if(tick_workers_exit) {
+            break;
+        }
+        run_region_tasks();
+        pthread_barrier_wait(&tick_barrier);
+    }
+    return NULL;
+}
+
+/* Starts the worker threads. The calling thread is the last of the n. */
+int tick_engine_start(unsigned int n) {
+    if(world->num_strips < 2 * n) {
+        fprintf(stderr, "Warning: %u strips %d tiles wide can keep at most %u threads busy\n",
+                world->num_strips, world->strip_width, (world->num_strips + 1) / 2);
+    }
+    tick_world = world;
+    region_tasks = calloc(world->num_strips, sizeof(unsigned int));
+    tick_threads = n;
+    pthread_barrier_init(&tick_barrier, NULL, n);
+    tick_workers = malloc(sizeof(pthread_t) * n);
+    unsigned int i;
+    for(i = 0; i + 1 < n; i++) {
+        if(pthread_create(&tick_workers[i], NULL, tick_worker_main, NULL) != 0) {
+            perror("pthread_create");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void tick_engine_stop() {
+    if(!tick_threads) {
+        return;
+    }
+    tick_workers_exit = 1;
+    pthread_barrier_wait(&tick_barrier);
+    unsigned int i;
+    for(i = 0; i + 1 < tick_threads; i++) {
+        pthread_join(tick_workers[i], NULL);
+    }
+    pthread_barrier_destroy(&tick_barrier);
+    free(tick_workers);
+    tick_threads = 0;
+}
+
+/* Sorts strip indices by decreasing cost */
+int region_cost_compare(const void* a, const void* b) {
+    unsigned long ca = world->regions[*(const unsigned int*)a].cost;
+    unsigned long cb = world->regions[*(const unsigned int*)b].cost;
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+/* Runs every strip of one parity, across the threads if threaded, else on this one in active list order */
+void run_region_phase(unsigned int parity, int threaded) {
+    unsigned int s;
+    if(!threaded) {
+        struct organism_list* phase = &world->phases[parity];
+        for(s = 0; s < phase->num; s++) {
+            if(!phase->items[s]->dying) {
+                current_region = &world->regions[phase->items[s]->strip];
+                organism_loop(phase->items[s]);
+            }
+        }
+        current_region = NULL;
+        return;
+    }
+    num_region_tasks = 0;
+    for(s = parity; s < world->num_strips; s += 2) {
+        if(world->regions[s].members.num > 0) {
+            region_tasks[num_region_tasks++] = s;
+        }
+    }
+    if(num_region_tasks == 0) {
+        return;
+    }
+    /* Biggest strips go first so the stragglers are cheap ones */
+    qsort(region_tasks, num_region_tasks, sizeof(unsigned int), region_cost_compare);
+    atomic_store(&next_region_task, 0);
+    pthread_barrier_wait(&tick_barrier);
+    run_region_tasks();
+    pthread_barrier_wait(&tick_barrier);
 }
 
-/* Main loop function that runs each organisms's bytecode. Returns 0 if all dead. */
+/* Runs one tick of every organism's bytecode. Returns 0 if all dead. */
 int main_loop() {
-    int organisms_exist = 0;
+    struct tick_region* regions = world->regions;
+    unsigned int s;
+    for(s = 0; s < world->num_strips; s++) {
+        regions[s].members.num = 0;
+        regions[s].deaths.num = 0;
+        regions[s].reproducing.num = 0;
+        regions[s].cost = 0;
+        regions[s].instructions = 0;
+    }
+
+    /* Sort organisms into strips by the left edge of their footprint, see organism_rect */
+    int threaded = tick_threads > 0;
+    unsigned int i;
+    world->phases[0].num = 0;
+    world->phases[1].num = 0;
+    for(i = 0; i < world->num_active; i++) {
+        struct organism* o = world->active[i];
+        struct tile_rect footprint = organism_rect(o);
+        int startx = footprint.x0;
+        if(footprint.x1 - footprint.x0 > STRIP_MAX_FOOTPRINT) { //too wide to keep strips apart this tick
+            threaded = 0;
+        }
+        if(startx < 0) {
+            startx = 0;
+        } else if(startx >= world->config.board_width) {
+            startx = world->config.board_width - 1;
+        }
+        o->strip = startx / world->strip_width;
+        organism_list_push(&world->phases[o->strip & 1], o);
+    }
+    if(!world->num_active) {
+        return 0;
+    }
+    if(threaded) {
+        for(i = 0; i < world->num_active; i++) {
+            struct organism* o = world->active[i];
+            organism_list_push(&regions[o->strip].members, o);
+            regions[o->strip].cost += 1 + o->width + o->height;
+        }
+    }
+
+    run_region_phase(0, threaded);
+    run_region_phase(1, threaded);
+
+    /* Carry out reproduction, then deaths, in strip order */
+    for(s = 0; s < world->num_strips; s++) {
+        world->instructions_executed += regions[s].instructions;
+        for(i = 0; i < regions[s].reproducing.num; i++) {
+            struct organism* o = regions[s].reproducing.items[i];
+            if(!o->dying) {
+                organism_reproduce(o);
+            }
+        }
+    }
+    for(s = 0; s < world->num_strips; s++) {
+        for(i = 0; i < regions[s].deaths.num; i++) {
+            organism_delete(regions[s].deaths.items[i], regions[s].deaths.items[i]->dying);
+        }
+    }
+    return 1;
+}
+
+/*
+ * Configuration loading. Every field of struct config can be set with a
+ * flag (--board-width 512, dashes or underscores) or with a
+ * "board_width = 512" line in a --config file, where '#' starts a comment.
+ * Later settings win.
+ */
+struct config_field {
+    const char* name;
+    size_t offset; //in struct config
+    int min;
+    int max;
+};
+
+const struct config_field config_fields[] = {
+    {"board_width",   offsetof(struct config, board_width),   1, 1 << 24},
+    {"board_height",  offsetof(struct config, board_height),  1, 1 << 24},
+    {"vm_slots",      offsetof(struct config, vm_slots),      1, 65535},
+    {"num_loe",       offsetof(struct config, num_loe),       1, 64},
+    {"num_reg",       offsetof(struct config, num_reg),       0, 10},
+    {"max_organisms", offsetof(struct config, max_organisms), 1, 1 << 30},
+    {"search_dist",   offsetof(struct config, search_dist),   0, 1 << 20},
+    {"org_to_food",   offsetof(struct config, org_to_food),   1, INT_MAX},
+    {"org_lifespan",  offsetof(struct config, org_lifespan),  0, INT_MAX},
+    {"org_hunger",    offsetof(struct config, org_hunger),    1, INT_MAX},
+    {"org_food",      offsetof(struct config, org_food),      0, INT_MAX},
+    {"quantum",       offsetof(struct config, quantum),       1, 65536},
+    {"mutation_decrement", offsetof(struct config, mutation_rates[MUTATION_DECREMENT]), 0, MUTATION_SCALE},
+    {"mutation_increment", offsetof(struct config, mutation_rates[MUTATION_INCREMENT]), 0, MUTATION_SCALE},
+    {"mutation_nudge",     offsetof(struct config, mutation_rates[MUTATION_NUDGE]),     0, MUTATION_SCALE},
+    {"mutation_random",    offsetof(struct config, mutation_rates[MUTATION_RANDOM]),    0, MUTATION_SCALE},
+    {"mutation_bit_flip",  offsetof(struct config, mutation_rates[MUTATION_BIT_FLIP]),  0, MUTATION_SCALE},
+    {"mutation_insert",    offsetof(struct config, mutation_rates[MUTATION_INSERT]),    0, MUTATION_SCALE},
+    {"mutation_delete",    offsetof(struct config, mutation_rates[MUTATION_DELETE]),    0, MUTATION_SCALE},
+    {"mutation_duplicate", offsetof(struct config, mutation_rates[MUTATION_DUPLICATE]), 0, MUTATION_SCALE}
+};
+
+/* Sets a field of c by name. Returns 1 if set, 0 if there is no such field and -1 (after saying why) if the value is bad. */
+int config_set(struct config* c, const char* name, const char* value) {
+    char key[64];
+    unsigned int i;
+    for(i = 0; name[i] && i + 1 < sizeof(key); i++) {
+        key[i] = name[i] == '-' ? '_' : name[i];
+    }
+    key[i] = 0;
+    for(i = 0; i < sizeof(config_fields) / sizeof(config_fields[0]); i++) {
+        const struct config_field* field = &config_fields[i];
+        if(strcmp(key, field->name) != 0) {
+            continue;
+        }
+        char* end;
+        long v = strtol(value, &end, 10);
+        if(end == value || *end || v < field->min || v > field->max) {
+            fprintf(stderr, "%s must be a number from %d to %d\n", field->name, field->min, field->max);
+            return -1;
+        }
+        *(int*)((char*)c + field->offset) = (int)v;
+        return 1;
+    }
+    return 0;
+}
+
+/* Reads "name = value" lines from a file into c. Returns 0 on failure. */
+int config_load(struct config* c, const char* path) {
+    FILE* in = fopen(path, "r");
+    if(!in) {
+        perror(path);
+        return 0;
+    }
+    char line[256];
+    int number = 0;
+    int ok = 1;
+    while(ok && fgets(line, sizeof(line), in)) {
+        number++;
+        char* comment = strchr(line, '#');
+        if(comment) {
+            *comment = 0;
+        }
+        char name[64];
+        char value[64];
+        char extra;
+        int fields = sscanf(line, " %63[A-Za-z_-] = %63s %c", name, value, &extra);
+        if(fields == EOF) { //blank
+            continue;
+        }
+        int set = fields == 2 ? config_set(c, name, value) : 0;
+        if(set == 0) {
+            fprintf(stderr, "%s:%d: expected a setting such as \"board_width = 512\"\n", path, number);
+        }
+        ok = set == 1;
+    }
+    fclose(in);
+    return ok;
+}
+
+/* Sizes everything in the current world that depends on its configuration. Call once, before its first organism. Returns 0 on failure. */
+int config_apply() {
+    world->env_blocks_x = (world->config.board_width  + ENV_BLOCK_SIZE - 1) / ENV_BLOCK_SIZE;
+    world->env_blocks_y = (world->config.board_height + ENV_BLOCK_SIZE - 1) / ENV_BLOCK_SIZE;
+    world->env_directory_shift = 0;
+    while((1u << world->env_directory_shift) < world->env_blocks_x) {
+        world->env_directory_shift++;
+    }
+    if(((unsigned long long)world->env_blocks_y << world->env_directory_shift) > (1ULL << 27)) {
+        fprintf(stderr, "Board of %dx%d is too large\n", world->config.board_width, world->config.board_height);
+        return 0;
+    }
+    world->env_directory_size = world->env_blocks_y << world->env_directory_shift;
+    world->environment = calloc(world->env_directory_size, sizeof(struct env_block*));
+    world->occupant_blocks = calloc(world->env_directory_size, sizeof(struct organism**));
+
+    world->genome_num_pages = (world->config.vm_slots + GENOME_PAGE_MASK) >> GENOME_PAGE_BITS;
+    world->organism_bytes = sizeof(union organism_block)
+                   + (lineage_enabled ? 2 : 1) * world->genome_num_pages * sizeof(struct genome_page*)
+                   + world->config.num_loe * (sizeof(struct context_info) + world->config.num_reg);
+    world->organism_bytes = (world->organism_bytes + 15) & ~(size_t)15; //keep every block aligned
+
+    /*
+     * Mutation sites are drawn as geometric gaps between them, by searching
+     * the table of how likely each gap is to be survived. Building the table
+     * here keeps log() (and libm) out of the build.
+     */
+    unsigned int m;
+    world->mutation_total = 0;
+    for(m = 0; m < MUTATIONS; m++) {
+        world->mutation_total += world->config.mutation_rates[m];
+    }
+    if(world->mutation_total > MUTATION_SCALE) {
+        fprintf(stderr, "Mutation rates add up to %u, more than %d\n", world->mutation_total, MUTATION_SCALE);
+        return 0;
+    }
+    world->mutation_survival = malloc((world->config.vm_slots + 1) * sizeof(double));
+    if(!world->mutation_survival) {
+        return 0;
+    }
+    double keep = 1.0 - (double)world->mutation_total / MUTATION_SCALE;
+    world->mutation_survival[0] = 1.0;
+    for(m = 1; m <= (unsigned int)world->config.vm_slots; m++) {
+        world->mutation_survival[m] = world->mutation_survival[m - 1] * keep;
+    }
+
+    organism_kernel_select();
+    return world->environment && world->occupant_blocks && strips_init();
+}
+
+/* Frees everything the current world allocated, leaving it as config_apply found it */
+void world_free() {
+    unsigned int i;
+    for(i = 0; i < world->env_directory_size; i++) {
+        free(world->environment[i]);
+        free(world->occupant_blocks[i]);
+    }
+    for(i = 0; i < world->organism_slots_used; i++) {
+        if(world->organisms[i]) {
+            bracket_table_release(world->organisms[i]->brackets);
+            genome_release(world->organisms[i]);
+            if(world->organisms[i]->archived) {
+                genome_table_release(world->organisms[i]->archived);
+            }
+        }
+    }
+    while(world->genome_free_pages) {
+        struct genome_page* page = world->genome_free_pages;
+        world->genome_free_pages = page->next;
+        free(page);
+    }
+    for(i = 0; i < world->num_organism_slabs; i++) {
+        free(world->organism_slabs[i]);
+    }
+    for(i = 0; i < world->num_strips; i++) {
+        free(world->regions[i].members.items);
+        free(world->regions[i].deaths.items);
+        free(world->regions[i].reproducing.items);
+    }
+    free(world->phases[0].items);
+    free(world->phases[1].items);
+    free(world->environment);
+    free(world->occupant_blocks);
+    free(world->organism_slabs);
+    free(world->organisms);
+    free(world->organism_generations);
+    free(world->free_slots);
+    free(world->active);
+    free(world->mutation_survival);
+    free(world->regions);
+    world->environment = NULL;
+    world->occupant_blocks = NULL;
+    world->organism_slabs = NULL;
+    world->num_organism_slabs = 0;
+    world->organism_free_list = NULL;
+    world->organisms = NULL;
+    world->organism_generations = NULL;
+    world->free_slots = NULL;
+    world->active = NULL;
+    world->num_active = 0;
+    world->active_capacity = 0;
+    world->regions = NULL;
+    world->num_strips = 0;
+    memset(world->phases, 0, sizeof(world->phases));
+    world->mutation_survival = NULL;
+    world->organism_capacity = 0;
+}
+
+/*
+ * Headless benchmarks. --bench steps a fixed population on the fixed board
+ * for a fixed number of ticks and prints the rates as one JSON object.
+ * Its organisms live BENCH_LIFESPAN ticks unless --org-lifespan says
+ * otherwise, and start at staggered ages, so the run keeps reproducing,
+ * mutating and splitting shared genome pages rather than only stepping.
+ * --microbench times the hot paths one at a time. bench.sh builds and runs
+ * both, and can check a run against a saved result.
+ */
+#define BENCH_ORGANISMS 2000
+#define BENCH_AREA      2048 //side of the square the population starts in
+#define BENCH_FOOD      5000
+#define BENCH_LIFESPAN  2500 //default config.org_lifespan under --bench, about two generations in the default 5000 ticks
+#define BENCH_STREAM    0xBE7C4ULL
+
+/* Seconds on a monotonic clock */
+double bench_now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Peak resident set size in KB */
+long bench_peak_rss() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/* Hash of every live organism's state and genome, in slot order, for comparing runs */
+unsigned long long world_state_hash() {
+    unsigned long long h = world->organism_births ^ (world->organism_deaths << 32);
+    unsigned int i;
+    unsigned int j;
+    for(i = 0; i < world->organism_slots_used; i++) {
+        struct organism* o = world->organisms[i];
+        if(!o) {
+            continue;
+        }
+        unsigned long long x = o->serial ^ ((unsigned long long)i << 40);
+        h += splitmix64(&x);
+        x ^= ((unsigned long long)o->pos.x << 32) | o->pos.y;
+        h += splitmix64(&x);
+        x ^= ((unsigned long long)o->width << 32) | o->height;
+        h += splitmix64(&x);
+        x ^= ((unsigned long long)(unsigned int)o->food << 32) | o->dir;
+        h += splitmix64(&x);
+        for(j = 0; j < (unsigned int)world->config.num_loe; j++) {
+            x ^= ((unsigned long long)o->loe[j].i_ptr << 32) | o->loe[j].ptr;
+            h += splitmix64(&x);
+        }
+        for(j = 0; j < (unsigned int)world->config.vm_slots; j++) {
+            x ^= vm_read(o, j);
+            h += splitmix64(&x);
+        }
+    }
+    return h;
+}
+
+/* Runs --bench and prints its JSON. started is when main() began. */
+int bench_run(unsigned int ticks, double started) {
+    struct rng placement;
+    rng_seed(&placement, world->seed, BENCH_STREAM);
+    struct collision_information_bundle ignored;
+    unsigned int k;
+    for(k = 0; k < BENCH_ORGANISMS; k++) {
+        struct organism* o = organism_factory();
+        if(!o) {
+            return 1;
+        }
+        organism_clear_location(o); //off the center, where organism_factory drew it
+        o->pos.x = (world->config.board_width  - BENCH_AREA)/2 + rng_below(&placement, BENCH_AREA);
+        o->pos.y = (world->config.board_height - BENCH_AREA)/2 + rng_below(&placement, BENCH_AREA);
+        o->food = BENCH_FOOD;
+        o->ticks_since_birth = rng_below(&placement, world->config.org_lifespan + 1u); //so births are spread over the run
+        organism_write_location(o, &ignored);
+    }
+    unsigned long long births = world->organism_births;
+    unsigned long long deaths = world->organism_deaths;
+    unsigned long long instructions = world->instructions_executed;
+    double start = bench_now();
+    unsigned int tick;
+    for(tick = 0; tick < ticks; tick++) {
+        if(!main_loop()) {
+            break;
+        }
+        world->current_tick++;
+        metrics_tick();
+    }
+    double seconds = bench_now() - start;
+    births = world->organism_births - births;
+    deaths = world->organism_deaths - deaths;
+    printf("{\"seed\": %llu, \"threads\": %u, \"quantum\": %d, \"organisms\": %u, \"ticks\": %u, \"alive\": %llu, ",
+           world->seed, tick_threads, world->config.quantum, BENCH_ORGANISMS, tick, world->organism_births - world->organism_deaths);
+    printf("\"startup_seconds\": %.6f, \"seconds\": %.6f, \"ticks_per_sec\": %.2f, \"instructions_per_sec\": %.0f, ",
+           start - started, seconds, tick / seconds, (world->instructions_executed - instructions) / seconds);
+    printf("\"births\": %llu, \"deaths\": %llu, \"births_per_sec\": %.2f, \"deaths_per_sec\": %.2f, \"peak_rss_kb\": %ld, \"blocks_allocated\": %u, \"genome_pages\": %u, ",
+           births, deaths, births / seconds, deaths / seconds, bench_peak_rss(), atomic_load(&world->env_blocks_allocated), atomic_load(&world->genome_pages));
+    printf("\"state_hash\": \"%016llx\"}\n", world_state_hash());
+    return 0;
+}
+
+/* Puts the microbenchmark organism back in the middle of the board, 1x1 and well fed */
+void bench_reset(struct organism* o) {
+    organism_clear_location(o);
+    o->pos.x = world->config.board_width/2;
+    o->pos.y = world->config.board_height/2;
+    o->width = 1;
+    o->height = 1;
+    o->dir = DIRECTION_UP;
+    o->food = 1000000000;
+    o->loe[0].i_ptr = 0;
+    o->loe[0].ptr = 0;
+    o->loe[0].loop_level = 0;
+    struct collision_information_bundle ignored;
+    organism_write_location(o, &ignored);
+}
+
+/* Nanoseconds per instruction for a VM filled with one instruction */
+double bench_opcode(struct organism* o, unsigned char instruction, unsigned int passes) {
+    struct collision_information_bundle collisions;
+    double elapsed = 0;
+    unsigned int pass;
     unsigned int i;
-    for(i = 0; i < max_organism_id+1; i++) {
-        if(organisms[i] != NULL) {
-            organisms_exist = 1;
-            organism_loop(organisms[i]);
+    unsigned char vm[world->config.vm_slots];
+    memset(vm, instruction, world->config.vm_slots);
+    for(pass = 0; pass < passes; pass++) {
+        genome_load(o, vm);
+        bench_reset(o);
+        double start = bench_now();
+        for(i = 0; i < world->config.vm_slots; i++) {
+            organism_checkup(o, config_shape());
+            bytecode_tick(o, 0, &collisions);
+            o->loe[0].i_ptr++;
+        }
+        elapsed += bench_now() - start;
+    }
+    return elapsed * 1e9 / ((double)passes * world->config.vm_slots);
+}
+
+/* Runs --microbench and prints its JSON */
+int microbench_run() {
+    const unsigned int calls = 200000;
+    double start = bench_now();
+    fill_environment();
+    printf("{\"fill_environment_ms\": %.2f, \"opcodes\": [", (bench_now() - start) * 1e3);
+
+    struct organism* o = organism_factory();
+    struct organism* other = organism_factory();
+    if(!o || !other) {
+        return 1;
+    }
+    unsigned int k;
+    for(k = 0; k <= 24; k++) {
+        unsigned char instruction = k == 24 ? 250 : k*10 + 1;
+        printf("%s{\"opcode\": \"%s\", \"byte\": %u, \"ns\": %.2f}", k ? ", " : "",
+               opcode_name(instruction), instruction, bench_opcode(o, instruction, 200));
+    }
+    printf("], ");
+
+    start = bench_now();
+    for(k = 0; k < calls / 100; k++) {
+        organism_lossy_copy(o, other);
+    }
+    printf("\"lossy_copy_ns\": %.2f, ", (bench_now() - start) * 1e9 / (calls / 100));
+
+    /* A 16x16 body, rewritten whole and then stepped back and forth */
+    struct collision_information_bundle collisions;
+    bench_reset(o);
+    organism_clear_location(o);
+    o->width = 16;
+    o->height = 16;
+    start = bench_now();
+    for(k = 0; k < calls / 10; k++) {
+        organism_clear_location(o);
+        organism_write_location(o, &collisions);
+    }
+    printf("\"write_location_16x16_ns\": %.2f, ", (bench_now() - start) * 1e9 / (calls / 10));
+    start = bench_now();
+    for(k = 0; k < calls; k++) {
+        organism_move_auto(1, k & 1 ? DIRECTION_LEFT : DIRECTION_RIGHT, o, &collisions);
+    }
+    printf("\"move_16x16_ns\": %.2f, ", (bench_now() - start) * 1e9 / calls);
+
+    /* Sensing from the same body, all four ways, bit planes then the reference walk */
+    int reference;
+    for(reference = 0; reference < 2; reference++) {
+        use_reference_interpreter = reference;
+        const char* suffix = reference ? "_reference" : "";
+        long found = 0;
+        start = bench_now();
+        for(k = 0; k < calls; k++) {
+            o->dir = k & 3;
+            found += organism_looking_at_organism_size(o);
+        }
+        printf("\"detect%s_ns\": %.2f, ", suffix, (bench_now() - start) * 1e9 / calls);
+        start = bench_now();
+        for(k = 0; k < calls; k++) {
+            o->dir = k & 3;
+            found += organism_looking_at_food(o);
+        }
+        printf("\"detect_food%s_ns\": %.2f, ", suffix, (bench_now() - start) * 1e9 / calls);
+        start = bench_now();
+        for(k = 0; k < calls; k++) {
+            o->dir = k & 3;
+            found += organism_looking_at_obstacle(o);
+        }
+        printf("\"detect_obstacle%s_ns\": %.2f, ", suffix, (bench_now() - start) * 1e9 / calls);
+        if(found < 0) { //keeps the searches from being optimized out
+            printf(" ");
+        }
+    }
+    use_reference_interpreter = 0;
+    printf("\"peak_rss_kb\": %ld}\n", bench_peak_rss());
+    return 0;
+}
+
+/*
+ * Ensembles. --ensemble N runs N independent worlds, seeded --seed,
+ * --seed+1, and so on, in one process on --threads threads (every core
+ * by default). --ensemble-file FILE takes one world per line instead,
+ * each a list of name=value settings over the command line's: seed,
+ * food_density, obstacle_density or any config field. Every world runs
+ * until it dies out, or for at most --ensemble-ticks ticks, and prints
+ * one JSON summary line when it finishes.
+ */
+struct ensemble {
+    struct world* worlds;
+    unsigned int num;
+    unsigned long long max_ticks; //0 for no limit
+    atomic_uint next;
+    atomic_int failed;
+    pthread_mutex_t output_lock;
+};
+
+/* Reads an --ensemble-file, one world per line on top of the template. Returns the number of worlds, 0 on failure. */
+unsigned int ensemble_load(const char* path, const struct world* template, struct world** worlds) {
+    FILE* in = fopen(path, "r");
+    if(!in) {
+        perror(path);
+        return 0;
+    }
+    char line[1024];
+    int number = 0;
+    unsigned int num = 0;
+    *worlds = NULL;
+    while(fgets(line, sizeof(line), in)) {
+        number++;
+        char* comment = strchr(line, '#');
+        if(comment) {
+            *comment = 0;
+        }
+        char* setting = strtok(line, " \t\r\n");
+        if(!setting) { //blank
+            continue;
+        }
+        *worlds = realloc(*worlds, sizeof(struct world) * (num + 1));
+        struct world* w = &(*worlds)[num++];
+        *w = *template;
+        for(; setting; setting = strtok(NULL, " \t\r\n")) {
+            char* value = strchr(setting, '=');
+            int set = 0;
+            if(value) {
+                *value++ = 0;
+                if(strcmp(setting, "seed") == 0) {
+                    w->seed = strtoull(value, NULL, 10);
+                    set = 1;
+                } else if(strcmp(setting, "food_density") == 0 || strcmp(setting, "food-density") == 0) {
+                    w->food_density = atof(value);
+                    set = 1;
+                } else if(strcmp(setting, "obstacle_density") == 0 || strcmp(setting, "obstacle-density") == 0) {
+                    w->obstacle_density = atof(value);
+                    set = 1;
+                } else {
+                    set = config_set(&w->config, setting, value);
+                }
+            }
+            if(set != 1) {
+                if(set == 0) {
+                    fprintf(stderr, "%s:%d: expected settings such as \"seed=3 org_hunger=200\"\n", path, number);
+                }
+                fclose(in);
+                free(*worlds);
+                return 0;
+            }
+        }
+    }
+    fclose(in);
+    if(num == 0) {
+        fprintf(stderr, "%s: no worlds\n", path);
+    }
+    return num;
+}
+
+/* Runs one world of the ensemble to the end and prints its summary */
+void ensemble_run_world(struct ensemble* e, unsigned int index) {
+    world = &e->worlds[index];
+    double started = bench_now();
+    if(!config_apply()) {
+        atomic_store(&e->failed, 1);
+        return;
+    }
+    generator_init();
+    unsigned long long peak = 0;
+    if(organism_factory()) {
+        while((!e->max_ticks || world->current_tick < e->max_ticks) && main_loop()) {
+            world->current_tick++;
+            unsigned long long alive = world->organism_births - world->organism_deaths;
+            if(alive > peak) {
+                peak = alive;
+            }
         }
     }
-    return organisms_exist;
+    int extinct = world->organism_births == world->organism_deaths;
+
+    pthread_mutex_lock(&e->output_lock);
+    printf("{\"world\": %u, \"seed\": %llu, \"ticks\": %llu, \"extinct\": %s, \"peak_population\": %llu, \"births\": %llu, \"deaths\": %llu, \"deaths_by_reason\": {",
+           index, world->seed, world->current_tick, extinct ? "true" : "false", peak, world->organism_births, world->organism_deaths);
+    unsigned int i;
+    for(i = 1; i < DEATH_REASONS; i++) {
+        printf("%s\"%u\": %llu", i > 1 ? ", " : "", i, world->organism_deaths_by_reason[i]);
+    }
+    printf("}, \"extinction_reason\": %d, \"blocks_allocated\": %u, \"seconds\": %.6f}\n",
+           extinct ? world->last_death_reason : 0, atomic_load(&world->env_blocks_allocated), bench_now() - started);
+    fflush(stdout);
+    pthread_mutex_unlock(&e->output_lock);
+    world_free();
+}
+
+void* ensemble_worker(void* arg) {
+    struct ensemble* e = arg;
+    unsigned int index;
+    while((index = atomic_fetch_add(&e->next, 1)) < e->num) {
+        ensemble_run_world(e, index);
+    }
+    return NULL;
+}
+
+/* Runs the worlds on up to threads threads (0 for one per core). Returns the exit status. */
+int ensemble_run(struct world* worlds, unsigned int num, unsigned int threads, unsigned long long max_ticks) {
+    struct ensemble e = {.worlds = worlds, .num = num, .max_ticks = max_ticks};
+    pthread_mutex_init(&e.output_lock, NULL);
+    atomic_init(&e.next, 0);
+    atomic_init(&e.failed, 0);
+    if(threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (unsigned int)cores : 1;
+    }
+    if(threads > num) {
+        threads = num;
+    }
+    pthread_t* workers = malloc(sizeof(pthread_t) * threads);
+    unsigned int started = 0;
+    while(started + 1 < threads && pthread_create(&workers[started], NULL, ensemble_worker, &e) == 0) {
+        started++;
+    }
+    ensemble_worker(&e);
+    unsigned int i;
+    for(i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    pthread_mutex_destroy(&e.output_lock);
+    world = &main_world;
+    return atomic_load(&e.failed);
 }
 
 int main(int argc, char** argv) {
-    srand(time(NULL)); //seed the random generator
+    double started = bench_now();
+    unsigned long long seed = time(NULL);
+    int seed_given = 0;
+    int bench = 0;
+    unsigned int bench_ticks = 5000;
+    int microbench = 0;
+    int trace = 0;
+    const char* metrics_sink = NULL;
+    unsigned long long metrics_interval = 1000;
+    int threads = 0;
+    int prefill = 0;
+    const char* trace_path = "trace.bin";
+    unsigned int ensemble_size = 0;
+    const char* ensemble_path = NULL;
+    unsigned long long ensemble_ticks = 0;
+    int view = 0;
+    unsigned int view_fps = 20;
+    int view_follow = 0;
+    int view_x = 0;
+    int view_y = 0;
+    const char* capture_path = NULL;
+    unsigned long long capture_interval = 1000;
+    int capture_x = 0;
+    int capture_y = 0;
+    int capture_width = 0;
+    int capture_height = 0;
+    unsigned int capture_scale = 0;
+    const char* lineage_path = NULL;
+    int set;
+    int i;
+    for(i = 1; i < argc; i++) { //the bench's defaults go in first, so flags and --config can still override them
+        if(strcmp(argv[i], "--bench") == 0) {
+            main_world.config.org_lifespan = BENCH_LIFESPAN;
+        }
+    }
+    for(i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--seed") == 0 && i+1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+            seed_given = 1;
+        } else if(strcmp(argv[i], "--reference-interpreter") == 0) {
+            use_reference_interpreter = 1;
+        } else if(strcmp(argv[i], "--trace") == 0 && i+1 < argc) {
+            trace = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--trace-file") == 0 && i+1 < argc) {
+            trace_path = argv[++i];
+        } else if(strcmp(argv[i], "--food-density") == 0 && i+1 < argc) {
+            world->food_density = atof(argv[++i]);
+        } else if(strcmp(argv[i], "--obstacle-density") == 0 && i+1 < argc) {
+            world->obstacle_density = atof(argv[++i]);
+        } else if(strcmp(argv[i], "--prefill") == 0) {
+            prefill = 1;
+        } else if(strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--metrics") == 0 && i+1 < argc) {
+            metrics_sink = argv[++i];
+        } else if(strcmp(argv[i], "--metrics-every") == 0 && i+1 < argc) {
+            metrics_interval = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--config") == 0 && i+1 < argc) {
+            if(!config_load(&main_world.config, argv[++i])) {
+                return 1;
+            }
+        } else if(strcmp(argv[i], "--bench") == 0) {
+            bench = 1;
+        } else if(strcmp(argv[i], "--bench-ticks") == 0 && i+1 < argc) {
+            bench_ticks = strtoul(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--microbench") == 0) {
+            microbench = 1;
+        } else if(strcmp(argv[i], "--ensemble") == 0 && i+1 < argc) {
+            ensemble_size = strtoul(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--ensemble-file") == 0 && i+1 < argc) {
+            ensemble_path = argv[++i];
+        } else if(strcmp(argv[i], "--ensemble-ticks") == 0 && i+1 < argc) {
+            ensemble_ticks = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--view") == 0) {
+            view = 1;
+        } else if(strcmp(argv[i], "--fps") == 0 && i+1 < argc) {
+            view_fps = strtoul(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--follow") == 0 && i+1 < argc) {
+            view_follow = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--at") == 0 && i+1 < argc && sscanf(argv[i+1], "%d,%d", &view_x, &view_y) == 2) {
+            view_follow = -1;
+            i++;
+        } else if(strcmp(argv[i], "--capture") == 0 && i+1 < argc) {
+            capture_path = argv[++i];
+        } else if(strcmp(argv[i], "--capture-every") == 0 && i+1 < argc) {
+            capture_interval = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--capture-region") == 0 && i+1 < argc
+                  && sscanf(argv[i+1], "%d,%d,%d,%d", &capture_x, &capture_y, &capture_width, &capture_height) == 4) {
+            i++;
+        } else if(strcmp(argv[i], "--capture-scale") == 0 && i+1 < argc) {
+            capture_scale = strtoul(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--decode-capture") == 0 && i+1 < argc) {
+            return capture_decode(argv[i+1]);
+        } else if(strcmp(argv[i], "--lineage") == 0 && i+1 < argc) {
+            lineage_path = argv[++i];
+        } else if(strcmp(argv[i], "--lineage-tree") == 0 && i+1 < argc) {
+            return lineage_tree(argv[i+1]);
+        } else if(strcmp(argv[i], "--lineage-genome") == 0 && i+2 < argc) {
+            return lineage_genome(argv[i+1], strtoull(argv[i+2], NULL, 10));
+        } else if(strcmp(argv[i], "--decode-trace") == 0 && i+1 < argc) {
+            return trace_decode(argv[i+1]);
+        } else if(strncmp(argv[i], "--", 2) == 0 && i+1 < argc && (set = config_set(&main_world.config, argv[i] + 2, argv[i+1])) != 0) {
+            if(set < 0) {
+                return 1;
+            }
+            i++;
+        } else {
+            fprintf(stderr, "Usage: %s [--seed N] [--reference-interpreter] [--trace LEVEL] [--trace-file PATH] [--threads N]\n", argv[0]);
+            fprintf(stderr, "       [--food-density F] [--obstacle-density F] [--prefill]\n");
+            fprintf(stderr, "       [--metrics PATH.jsonl|PATH.csv|PATH.prom] [--metrics-every N]\n");
+            fprintf(stderr, "       [--bench] [--bench-ticks N] [--microbench]\n");
+            fprintf(stderr, "       [--ensemble N | --ensemble-file FILE] [--ensemble-ticks N]\n");
+            fprintf(stderr, "       [--view] [--fps N] [--follow ID | --at X,Y]\n");
+            fprintf(stderr, "       [--capture PATH] [--capture-every N] [--capture-region X,Y,W,H] [--capture-scale N]\n");
+            fprintf(stderr, "       [--lineage PATH]\n");
+            fprintf(stderr, "       [--config FILE] [--board-width N] [--board-height N] [--vm-slots N] [--num-loe N]\n");
+            fprintf(stderr, "       [--num-reg N] [--max-organisms N] [--search-dist N] [--org-to-food N]\n");
+            fprintf(stderr, "       [--org-lifespan N] [--org-hunger N] [--org-food N] [--quantum N]\n");
+            fprintf(stderr, "       [--mutation-decrement N] [--mutation-increment N] [--mutation-nudge N] [--mutation-random N]\n");
+            fprintf(stderr, "       [--mutation-bit-flip N] [--mutation-insert N] [--mutation-delete N] [--mutation-duplicate N]\n");
+            fprintf(stderr, "       %s --decode-trace PATH\n", argv[0]);
+            fprintf(stderr, "       %s --decode-capture PATH\n", argv[0]);
+            fprintf(stderr, "       %s --lineage-tree PATH | --lineage-genome PATH SERIAL\n", argv[0]);
+            return 1;
+        }
+    }
+    if(ensemble_size || ensemble_path) {
+        if(trace || metrics_sink || bench || microbench || prefill || view || capture_path || lineage_path) {
+            fprintf(stderr, "--ensemble cannot be combined with --trace, --metrics, --bench, --microbench, --prefill, --view, --capture or --lineage\n");
+            return 1;
+        }
+        main_world.seed = seed;
+        struct world* worlds;
+        if(ensemble_path) {
+            ensemble_size = ensemble_load(ensemble_path, &main_world, &worlds);
+            if(!ensemble_size) {
+                return 1;
+            }
+        } else {
+            worlds = malloc(sizeof(struct world) * ensemble_size);
+            for(i = 0; i < ensemble_size; i++) {
+                worlds[i] = main_world;
+                worlds[i].seed = seed + i;
+            }
+        }
+        int status = ensemble_run(worlds, ensemble_size, threads, ensemble_ticks);
+        free(worlds);
+        return status;
+    }
+    lineage_enabled = lineage_path != NULL; //organisms need room for a second page table
+    if(!config_apply()) {
+        return 1;
+    }
+    if(trace > TRACE_LEVEL) {
+        fprintf(stderr, "Trace level %d is not compiled in (TRACE_LEVEL is %d)\n", trace, TRACE_LEVEL);
+    }
+    if(trace > 0 && !trace_start(trace_path, trace)) {
+        return 1;
+    }
+    if(metrics_sink && !metrics_start(metrics_sink, metrics_interval)) { //before the workers, so they get counters
+        return 1;
+    }
+    if(threads > 0 && !tick_engine_start(threads)) {
+        return 1;
+    }
+    if((bench || microbench) && !seed_given) { //benchmarks are only comparable on the same world
+        seed = 1;
+    }
+    world->seed = seed; //seed the random streams
+    if(lineage_path && !lineage_start(lineage_path)) {
+        return 1;
+    }
     
     /* Set up terminal width and height (non-portable) */
-    columns = atoi(getenv("COLUMNS"));
-    rows    = atoi(getenv("LINES"));
+    columns = getenv("COLUMNS") ? atoi(getenv("COLUMNS")) : 80;
+    rows    = getenv("LINES")   ? atoi(getenv("LINES"))   : 24;
     
-    /* Set organisms array to be null */
-    memset(organisms, 0, sizeof(struct organism*) * MAX_ORGANISMS);
-    
-    /* Fill environment with randomly generated things */
-    fill_environment();
+    /* The board is generated lazily from the seed; --prefill does it all up front */
+    generator_init();
+    if(microbench) {
+        int status = microbench_run();
+        lineage_stop();
+        return status;
+    }
+    if(prefill) {
+        fill_environment();
+    }
+    if(bench) {
+        int status = bench_run(bench_ticks, started);
+        lineage_stop();
+        tick_engine_stop();
+        metrics_stop();
+        trace_stop();
+        return status;
+    }
     
-    /*struct organism* test = */organism_factory();
-    //organism_make_capable(test);
-    while(main_loop()) {
-        //draw_to_console();
+    struct organism* first = organism_factory();
+    TRACE(TRACE_EVENTS, first->id, TRACE_BIRTH, 0, (unsigned int)-1, first->pos.x, first->pos.y, 0);
+    //organism_make_capable(first);
+    if(view && !viewer_start(view_fps, view_follow, view_x, view_y)) {
+        return 1;
+    }
+    if(capture_path && !capture_start(capture_path, capture_interval, capture_x, capture_y, capture_width, capture_height, capture_scale)) {
+        return 1;
+    }
+    while(!atomic_load_explicit(&viewer.quit, memory_order_relaxed) && main_loop()) {
+        world->current_tick++;
+        metrics_tick();
+        capture_tick();
+        viewer_tick();
         //organism_print(test);
         ////PAUSE_FROM_STACKOVERFLOW();
     }
+    viewer_stop();
+    capture_stop();
+    lineage_stop();
+    tick_engine_stop();
+    metrics_stop();
+    trace_stop();
+    if(atomic_load(&viewer.quit)) {
+        printf("Stopped at tick %llu.\n", world->current_tick);
+        return 0;
+    }
     printf("Everybody died.\n");
     return 0;
 }